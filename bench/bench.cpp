@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8_core/batch.h"
+#include "chip8_core/core.h"
+#include "chip8_core/jit.h"
+#include "chip8_core/state.h"
+
+/*
+Microbenchmarks for the core, in the spirit of Google Benchmark: every case is
+rerun with more iterations until it takes at least --min-time seconds, and the
+results are written as JSON so runs can be diffed between versions.
+
+Usage:
+./chip8_bench [--filter TEXT] [--min-time SECONDS] [--json FILE] [--roms DIR]
+
+Opcode cases call Emu::execute on one opcode in a loop. BM_Snapshot cases
+take and restore one Snapshot per iteration, as run-ahead does every frame,
+with the machine in low resolution, high resolution or XO-CHIP mode. ROM cases run the
+*.ch8 files in --roms (default roms/bench) frame by frame, BM_Rom through
+Emu::tick, BM_RomRun through Emu::run_frame and BM_Jit through Jit::run_frame.
+The run fails if BM_Jit is not faster than BM_RomRun on a ROM that ran both.
+BM_Batch runs BATCH_LANES copies at once through EmuBatch; its items count
+every lane, so compare it with BM_Rom, which is one lane's worth.
+*/
+
+#ifndef CHIP8_BENCH_ROM_DIR
+#define CHIP8_BENCH_ROM_DIR "roms/bench"
+#endif
+
+struct BenchState {
+    size_t iterations;   // times to run the measured body
+    uint64_t items;      // instructions executed, reported per second
+    uint64_t frames;     // frames executed, reported per second
+    double seconds;      // time between start() and stop()
+
+    // Bracket the measured loop so setup is not timed
+    void start() { started = std::chrono::steady_clock::now(); }
+    void stop() { seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count(); }
+
+    std::chrono::steady_clock::time_point started;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(BenchState&)> run;
+};
+
+struct BenchResult {
+    std::string name;
+    size_t iterations;
+    double seconds;
+    uint64_t items;
+    uint64_t frames;
+};
+
+// Registers read by DXYN and the FX ops, set up before the timed loop
+struct OpSetup {
+    uint8_t vx;
+    uint8_t vy;
+    uint16_t i_reg;
+};
+
+constexpr uint16_t SPRITE_ADDR = 0x300;
+constexpr size_t FRAMES_PER_ITERATION = 60;
+constexpr size_t BATCH_LANES = 64;
+
+static void bench_opcode(BenchState& state, uint16_t op, OpSetup setup) {
+    // Emu is large; keep it off the stack
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->seed(1);
+    for (uint8_t row = 0; row < 15; ++row) {
+        emu->ram[SPRITE_ADDR + row] = row % 2 ? 0xA5 : 0xFF;
+    }
+    for (uint8_t r = 0; r < NUM_REGS; ++r) {
+        emu->v_reg[r] = r * 17 + 3;
+    }
+    // Y first: for 3XNN and friends the Y nibble is part of NN
+    emu->v_reg[(op >> 4) & 0xF] = setup.vy;
+    emu->v_reg[(op >> 8) & 0xF] = setup.vx;
+    emu->i_reg = setup.i_reg;
+
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        emu->execute(op);
+    }
+    state.stop();
+    state.items = state.iterations;
+}
+
+static void bench_rom(BenchState& state, const std::vector<uint8_t>& rom) {
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->seed(1);
+    emu->load(rom.data(), rom.size());
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        for (size_t frame = 0; frame < FRAMES_PER_ITERATION; ++frame) {
+            for (size_t t = 0; t < TICKS_PER_FRAME; ++t) {
+                emu->tick();
+            }
+            emu->tick_timers();
+        }
+    }
+    state.stop();
+    state.frames = state.iterations * FRAMES_PER_ITERATION;
+    state.items = state.frames * TICKS_PER_FRAME;
+}
+
+// Same frames as bench_rom, driven through Emu::run_frame. Items still count
+// TICKS_PER_FRAME per frame so the two are directly comparable.
+static void bench_rom_run(BenchState& state, const std::vector<uint8_t>& rom) {
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->seed(1);
+    emu->load(rom.data(), rom.size());
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        for (size_t frame = 0; frame < FRAMES_PER_ITERATION; ++frame) {
+            emu->run_frame();
+        }
+    }
+    state.stop();
+    state.frames = state.iterations * FRAMES_PER_ITERATION;
+    state.items = state.frames * TICKS_PER_FRAME;
+}
+
+// Same frames again through the JIT. Blocks are compiled inside the timed
+// loop, so the compile cost is part of the result, as it is for a real run.
+static void bench_rom_jit(BenchState& state, const std::vector<uint8_t>& rom) {
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->seed(1);
+    emu->load(rom.data(), rom.size());
+    Jit jit;
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        for (size_t frame = 0; frame < FRAMES_PER_ITERATION; ++frame) {
+            jit.run_frame(*emu);
+        }
+    }
+    state.stop();
+    state.frames = state.iterations * FRAMES_PER_ITERATION;
+    state.items = state.frames * TICKS_PER_FRAME;
+}
+
+// setup puts the machine into the mode being measured. One RAM page is
+// written per iteration so each snapshot has a page to copy, like a frame
+// that stores a score.
+static void bench_snapshot(BenchState& state, QuirkProfile profile, uint16_t setup) {
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->set_quirks(profile);
+    if (setup != 0)
+        emu->execute(setup);
+    Snapshotter snapshotter;
+    Snapshot snap;
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        emu->ram[SPRITE_ADDR] = uint8_t(i);
+        emu->invalidate(SPRITE_ADDR, 1);
+        snapshotter.snapshot(*emu, snap);
+        snapshotter.restore(*emu, snap);
+    }
+    state.stop();
+    state.items = state.iterations;
+}
+
+// BATCH_LANES copies of the ROM in lock-step, each with its own CXNN seed
+static void bench_rom_batch(BenchState& state, const std::vector<uint8_t>& rom) {
+    EmuBatch batch(BATCH_LANES);
+    batch.load(rom.data(), rom.size());
+    for (size_t lane = 0; lane < BATCH_LANES; ++lane) {
+        batch.seed(lane, lane + 1);
+    }
+    state.start();
+    for (size_t i = 0; i < state.iterations; ++i) {
+        for (size_t frame = 0; frame < FRAMES_PER_ITERATION; ++frame) {
+            for (size_t t = 0; t < TICKS_PER_FRAME; ++t) {
+                batch.step_all();
+            }
+            batch.tick_timers();
+        }
+    }
+    state.stop();
+    state.frames = state.iterations * FRAMES_PER_ITERATION * BATCH_LANES;
+    state.items = state.frames * TICKS_PER_FRAME;
+}
+
+static void add_opcode(std::vector<Benchmark>& out, const char* name, uint16_t op, OpSetup setup = {0x12, 0x34, SPRITE_ADDR}) {
+    out.push_back({std::string("BM_Op/") + name, [op, setup](BenchState& state) {
+        bench_opcode(state, op, setup);
+    }});
+}
+
+static std::vector<Benchmark> opcode_benchmarks() {
+    std::vector<Benchmark> out;
+
+    // 8XYN ALU
+    add_opcode(out, "8XY0_ld", 0x8120);
+    add_opcode(out, "8XY1_or", 0x8121);
+    add_opcode(out, "8XY2_and", 0x8122);
+    add_opcode(out, "8XY3_xor", 0x8123);
+    add_opcode(out, "8XY4_add", 0x8124);
+    add_opcode(out, "8XY5_sub", 0x8125);
+    add_opcode(out, "8XY6_shr", 0x8126);
+    add_opcode(out, "8XY7_subn", 0x8127);
+    add_opcode(out, "8XYE_shl", 0x812E);
+    add_opcode(out, "7XNN_add", 0x7105);
+
+    // Skips, taken and not taken
+    add_opcode(out, "3XNN_taken", 0x3112, {0x12, 0x00, 0});
+    add_opcode(out, "3XNN_not_taken", 0x3113, {0x12, 0x00, 0});
+    add_opcode(out, "4XNN_taken", 0x4113, {0x12, 0x00, 0});
+    add_opcode(out, "5XY0_taken", 0x5120, {0x12, 0x12, 0});
+    add_opcode(out, "9XY0_taken", 0x9120, {0x12, 0x34, 0});
+    add_opcode(out, "EX9E_not_taken", 0xE19E, {0x05, 0x00, 0});
+
+    // DXYN at several heights, inside the screen and wrapping off each edge
+    add_opcode(out, "DXYN_h1", 0xD121, {8, 4, SPRITE_ADDR});
+    add_opcode(out, "DXYN_h5_font", 0xD125, {8, 4, 0});
+    add_opcode(out, "DXYN_h8", 0xD128, {8, 4, SPRITE_ADDR});
+    add_opcode(out, "DXYN_h15", 0xD12F, {8, 4, SPRITE_ADDR});
+    add_opcode(out, "DXYN_h8_wrap_x", 0xD128, {60, 4, SPRITE_ADDR});
+    add_opcode(out, "DXYN_h15_wrap_y", 0xD12F, {8, 24, SPRITE_ADDR});
+    add_opcode(out, "DXYN_h15_wrap_xy", 0xD12F, {61, 24, SPRITE_ADDR});
+
+    // FX memory ops
+    add_opcode(out, "FX33_bcd", 0xF133, {0xEA, 0x00, 0x400});
+    add_opcode(out, "FX55_store_v0_vF", 0xFF55, {0, 0, 0x400});
+    add_opcode(out, "FX65_load_v0_vF", 0xFF65, {0, 0, 0x400});
+    add_opcode(out, "FX55_store_v0_v3", 0xF355, {0, 0, 0x400});
+    add_opcode(out, "FX65_load_v0_v3", 0xF365, {0, 0, 0x400});
+
+    // Control flow
+    add_opcode(out, "1NNN_jp", 0x1300);
+    add_opcode(out, "ANNN_ld_i", 0xA300);
+    add_opcode(out, "CXNN_rnd", 0xC1FF);
+
+    out.push_back({"BM_Snapshot/lores", [](BenchState& state) {
+        bench_snapshot(state, QuirkProfile::Default, 0);
+    }});
+    out.push_back({"BM_Snapshot/hires", [](BenchState& state) {
+        bench_snapshot(state, QuirkProfile::SuperChip, 0x00FF);
+    }});
+    out.push_back({"BM_Snapshot/xochip", [](BenchState& state) {
+        bench_snapshot(state, QuirkProfile::XoChip, 0);
+    }});
+    return out;
+}
+
+static std::vector<Benchmark> rom_benchmarks(const std::string& dir) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".ch8")
+            paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+    if (paths.empty())
+        std::cerr << "No ROMs found in " << dir << "\n";
+
+    std::vector<Benchmark> out;
+    for (const std::string& path : paths) {
+        std::ifstream file(path, std::ios::binary);
+        auto rom = std::make_shared<std::vector<uint8_t>>(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+        if (rom->size() > RAM_SIZE - START_ADDR) {
+            std::cerr << "Skipping " << path << ": ROM too large\n";
+            continue;
+        }
+        std::string stem = fs::path(path).stem().string();
+        out.push_back({"BM_Rom/" + stem, [rom](BenchState& state) { bench_rom(state, *rom); }});
+        out.push_back({"BM_RomRun/" + stem, [rom](BenchState& state) { bench_rom_run(state, *rom); }});
+        out.push_back({"BM_Batch/" + stem, [rom](BenchState& state) { bench_rom_batch(state, *rom); }});
+        if (CHIP8_JIT_SUPPORTED)
+            out.push_back({"BM_Jit/" + stem, [rom](BenchState& state) { bench_rom_jit(state, *rom); }});
+    }
+    return out;
+}
+
+// Grows the iteration count until one run lasts at least min_time
+static BenchResult measure(const Benchmark& bench, double min_time) {
+    size_t iterations = 1;
+    while (true) {
+        BenchState state = {iterations, 0, 0, 0.0, {}};
+        bench.run(state);
+        double seconds = state.seconds;
+
+        if (seconds >= min_time || iterations >= (size_t(1) << 40))
+            return {bench.name, iterations, seconds, state.items, state.frames};
+
+        // Aim a little past min_time so the next run usually suffices
+        double scale = seconds > 0 ? 1.4 * min_time / seconds : 10.0;
+        scale = std::min(std::max(scale, 2.0), 100.0);
+        iterations = size_t(iterations * scale);
+    }
+}
+
+static std::string json_escape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static void write_json(std::FILE* out, const std::vector<BenchResult>& results) {
+    char date[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    std::fprintf(out, "{\n  \"context\": {\n");
+    std::fprintf(out, "    \"date\": \"%s\",\n", date);
+    std::fprintf(out, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(out, "    \"table_dispatch\": %s,\n", CHIP8_TABLE_DISPATCH ? "true" : "false");
+#ifdef NDEBUG
+    std::fprintf(out, "    \"build_type\": \"release\"\n");
+#else
+    std::fprintf(out, "    \"build_type\": \"debug\"\n");
+#endif
+    std::fprintf(out, "  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        std::fprintf(out, "    {\n");
+        std::fprintf(out, "      \"name\": \"%s\",\n", json_escape(r.name).c_str());
+        std::fprintf(out, "      \"iterations\": %zu,\n", r.iterations);
+        std::fprintf(out, "      \"real_time\": %.4f,\n", r.seconds * 1e9 / r.iterations);
+        std::fprintf(out, "      \"time_unit\": \"ns\",\n");
+        std::fprintf(out, "      \"items_per_second\": %.1f", r.items / r.seconds);
+        if (r.frames > 0)
+            std::fprintf(out, ",\n      \"frames_per_second\": %.1f", r.frames / r.seconds);
+        std::fprintf(out, "\n    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+// The JIT is only worth its complexity if it beats the interpreter it falls
+// back to, so every ROM that ran both ways is held to that. Returns how many
+// did not.
+static size_t check_jit(const std::vector<BenchResult>& results) {
+    size_t slower = 0;
+    for (const BenchResult& jit : results) {
+        if (jit.name.compare(0, 7, "BM_Jit/") != 0)
+            continue;
+        std::string name = "BM_RomRun/" + jit.name.substr(7);
+        for (const BenchResult& run : results) {
+            if (run.name != name)
+                continue;
+            double jit_rate = jit.items / jit.seconds;
+            double run_rate = run.items / run.seconds;
+            if (jit_rate <= run_rate) {
+                std::fprintf(stderr, "%s is slower than %s (%.0f vs %.0f items/s)\n",
+                             jit.name.c_str(), run.name.c_str(), jit_rate, run_rate);
+                slower++;
+            }
+        }
+    }
+    return slower;
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string json_path;
+    std::string rom_dir = CHIP8_BENCH_ROM_DIR;
+    double min_time = 0.5;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (std::strcmp(arg, "--min-time") == 0 && has_value) {
+            min_time = std::strtod(argv[++i], nullptr);
+        } else if (std::strcmp(arg, "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else if (std::strcmp(arg, "--roms") == 0 && has_value) {
+            rom_dir = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--filter TEXT] [--min-time SECONDS] [--json FILE] [--roms DIR]\n";
+            return 1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks = opcode_benchmarks();
+    for (Benchmark& bench : rom_benchmarks(rom_dir)) {
+        benchmarks.push_back(std::move(bench));
+    }
+
+    std::vector<BenchResult> results;
+    std::fprintf(stderr, "%-32s %14s %14s %16s\n", "Benchmark", "Time (ns)", "Iterations", "Items/s");
+    for (const Benchmark& bench : benchmarks) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+            continue;
+        BenchResult r = measure(bench, min_time);
+        std::fprintf(stderr, "%-32s %14.2f %14zu %16.0f\n",
+                     r.name.c_str(), r.seconds * 1e9 / r.iterations, r.iterations, r.items / r.seconds);
+        results.push_back(r);
+    }
+
+    // JSON goes to stdout unless a file was given, so the table never mixes in
+    std::FILE* out = stdout;
+    if (!json_path.empty()) {
+        out = std::fopen(json_path.c_str(), "w");
+        if (!out) {
+            std::cerr << "Could not write " << json_path << "\n";
+            return 1;
+        }
+    }
+    write_json(out, results);
+    if (out != stdout)
+        std::fclose(out);
+    return check_jit(results) == 0 ? 0 : 1;
+}
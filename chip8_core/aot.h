@@ -0,0 +1,59 @@
+#pragma once
+
+#include "core.h"
+
+#include <cstdint>
+#include <cstddef>
+
+// A ROM translated ahead of time by tools/aot.cpp. The generated translation
+// unit defines one of these; link it next to chip8_core and drive it with aot_step().
+struct AotProgram {
+    const char* name;
+    const uint8_t* rom;
+    size_t rom_size;
+    // Runs the compiled block emu.pc lies in from there, for at most budget
+    // instructions, and returns the instructions retired, or 0 if no block
+    // covers emu.pc, its bytes were overwritten or it is an opcode that traps
+    size_t (*step)(Emu& emu, size_t budget);
+};
+
+// Runs the compiled block at emu.pc for at most max_instructions (at least
+// one), falling back to the interpreter for a single instruction. Compiled
+// blocks assume QuirkProfile::Default, so other profiles always take the
+// fallback. Opcodes that trap are never compiled, so a trap always comes
+// from the fallback: stop is then StopReason::Trap and status what tick()
+// returned. Callers should stop on Status::Halted.
+inline RunResult aot_step(const AotProgram& program, Emu& emu, uint32_t max_instructions) {
+    RunResult result{0, StopReason::Budget, Status::Ok, 0};
+    if (emu.quirks == QuirkProfile::Default)
+        result.cycles = uint32_t(program.step(emu, max_instructions > 0 ? max_instructions : 1));
+    if (result.cycles == 0) {
+        result.status = emu.tick();
+        result.cycles = 1;
+        if (result.status != Status::Ok) {
+            result.stop = StopReason::Trap;
+            result.traps = result.status == Status::Trapped;
+        }
+    }
+    return result;
+}
+
+// Emu::run_frame() through aot_step(): exactly TICKS_PER_FRAME instructions
+// unless one halts, then tick_timers(), so frames match the interpreter's
+inline RunResult aot_run_frame(const AotProgram& program, Emu& emu) {
+    RunResult frame{0, StopReason::Budget, Status::Ok, 0};
+    while (frame.cycles < TICKS_PER_FRAME) {
+        RunResult result = aot_step(program, emu, uint32_t(TICKS_PER_FRAME - frame.cycles));
+        frame.cycles += result.cycles;
+        frame.traps += result.traps;
+        if (result.status == Status::Halted) {
+            frame.stop = StopReason::Trap;
+            frame.status = Status::Halted;
+            break;
+        }
+    }
+    if (frame.status != Status::Halted && frame.traps > 0)
+        frame.status = Status::Trapped;
+    emu.tick_timers();
+    return frame;
+}
@@ -0,0 +1,98 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+AudioSynth::AudioSynth() : phase(0.0) {
+}
+
+void AudioSynth::render_frame(const Emu& emu, int16_t* out) {
+    if (emu.st == 0) {
+        std::fill(out, out + AUDIO_SAMPLES_PER_FRAME, 0);
+        return;
+    }
+
+    // An XO-CHIP ROM that never ran F002 still gets the buzzer
+    bool pattern = emu.quirks == QuirkProfile::XoChip &&
+        std::any_of(emu.audio_pattern, emu.audio_pattern + AUDIO_PATTERN_SIZE, [](uint8_t b) { return b != 0; });
+    if (!pattern) {
+        double step = AUDIO_TONE_HZ / AUDIO_SAMPLE_RATE;
+        for (size_t i = 0; i < AUDIO_SAMPLES_PER_FRAME; ++i) {
+            out[i] = phase < 0.5 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            phase += step;
+            if (phase >= 1.0)
+                phase -= 1.0;
+        }
+        return;
+    }
+
+    // XO-CHIP: the 128-bit pattern loops at 4000 * 2^((pitch - 64) / 48) bits per second
+    constexpr size_t bits = AUDIO_PATTERN_SIZE * 8;
+    double step = 4000.0 * std::exp2((emu.pitch - 64) / 48.0) / AUDIO_SAMPLE_RATE;
+    if (phase >= bits)
+        phase = std::fmod(phase, bits);
+    for (size_t i = 0; i < AUDIO_SAMPLES_PER_FRAME; ++i) {
+        size_t bit = size_t(phase);
+        bool on = (emu.audio_pattern[bit / 8] >> (7 - bit % 8)) & 1;
+        out[i] = on ? AUDIO_VOLUME : -AUDIO_VOLUME;
+        phase += step;
+        if (phase >= bits)
+            phase -= bits;
+    }
+}
+
+size_t AudioSynth::render_frame(const Emu& emu, AudioRing& ring) {
+    int16_t samples[AUDIO_SAMPLES_PER_FRAME];
+    render_frame(emu, samples);
+    return ring.push_many(samples, AUDIO_SAMPLES_PER_FRAME);
+}
+
+WavWriter::WavWriter(const char* path, uint32_t sample_rate)
+    : file(std::fopen(path, "wb")), sample_rate(sample_rate), data_bytes(0) {
+    if (!file)
+        throw std::runtime_error("Could not open wav file");
+    write_header();
+}
+
+WavWriter::~WavWriter() {
+    std::fseek(file, 0, SEEK_SET);
+    write_header();
+    std::fclose(file);
+}
+
+void WavWriter::write(const int16_t* samples, size_t count) {
+    // RIFF is little-endian, like every platform the emulator targets
+    std::fwrite(samples, sizeof(int16_t), count, file);
+    data_bytes += uint32_t(count * sizeof(int16_t));
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) {
+        out[i] = uint8_t(value >> (8 * i));
+    }
+}
+
+static void put_u16(uint8_t* out, uint16_t value) {
+    out[0] = uint8_t(value);
+    out[1] = uint8_t(value >> 8);
+}
+
+void WavWriter::write_header() {
+    uint8_t header[44] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        'd', 'a', 't', 'a', 0, 0, 0, 0,
+    };
+    put_u32(header + 4, 36 + data_bytes);
+    put_u32(header + 16, 16);                  // fmt chunk size
+    put_u16(header + 20, 1);                   // PCM
+    put_u16(header + 22, 1);                   // mono
+    put_u32(header + 24, sample_rate);
+    put_u32(header + 28, sample_rate * sizeof(int16_t));
+    put_u16(header + 32, sizeof(int16_t));     // block align
+    put_u16(header + 34, 16);                  // bits per sample
+    put_u32(header + 40, data_bytes);
+    std::fwrite(header, sizeof(header), 1, file);
+}
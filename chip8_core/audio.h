@@ -0,0 +1,64 @@
+#pragma once
+
+#include "core.h"
+#include "spsc_ring.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+constexpr uint32_t AUDIO_SAMPLE_RATE = 44100;
+// 44100 / 60 is whole, so frames and samples never drift apart
+constexpr size_t AUDIO_SAMPLES_PER_FRAME = AUDIO_SAMPLE_RATE / 60;
+static_assert(AUDIO_SAMPLE_RATE % 60 == 0, "one frame must be a whole number of samples");
+
+// Tone of the classic buzzer; XO-CHIP plays its pattern buffer instead
+constexpr double AUDIO_TONE_HZ = 440.0;
+constexpr int16_t AUDIO_VOLUME = 6000;
+
+// About 190 ms at 44.1 kHz, so a late producer never starves the device but
+// the tone still stops promptly
+constexpr size_t AUDIO_RING_SIZE = 1 << 13;
+
+// Mono signed 16-bit PCM from the emulation thread to the audio device
+using AudioRing = SpscRing<int16_t, AUDIO_RING_SIZE>;
+
+// Turns sound timer state into PCM, one frame at a time. The phase carries
+// over between frames so a tone spanning several frames has no seams.
+class AudioSynth {
+public:
+    AudioSynth();
+
+    // Writes AUDIO_SAMPLES_PER_FRAME samples for the frame about to run: the
+    // buzzer (or a loaded XO-CHIP pattern at emu.pitch) while emu.st is non-zero,
+    // silence otherwise. Call once per frame before stepping the emulator.
+    void render_frame(const Emu& emu, int16_t* out);
+
+    // Renders a frame and queues it, dropping what does not fit so the
+    // caller never waits on the consumer. Returns how many samples were queued.
+    size_t render_frame(const Emu& emu, AudioRing& ring);
+
+private:
+    double phase;  // tone periods, or pattern bits for XO-CHIP
+};
+
+// Writes mono 16-bit PCM to a .wav file, for testing without a sound device
+class WavWriter {
+public:
+    // Throws if the file cannot be created
+    explicit WavWriter(const char* path, uint32_t sample_rate = AUDIO_SAMPLE_RATE);
+    // Patches the chunk sizes in the header
+    ~WavWriter();
+
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    void write(const int16_t* samples, size_t count);
+
+private:
+    void write_header();
+
+    std::FILE* file;
+    uint32_t sample_rate;
+    uint32_t data_bytes;
+};
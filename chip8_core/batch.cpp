@@ -0,0 +1,395 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <array>
+#include <random>
+
+// Lanes sit back to back in ram, stack and keys, so every index is wrapped
+// to the lane's own slice instead of running into the next lane
+constexpr size_t ADDR_MASK = RAM_SIZE - 1;
+constexpr size_t STACK_MASK = STACK_SIZE - 1;
+constexpr size_t KEY_MASK = NUM_KEYS - 1;
+static_assert((RAM_SIZE & ADDR_MASK) == 0 && (STACK_SIZE & STACK_MASK) == 0 && (NUM_KEYS & KEY_MASK) == 0,
+              "lane slices must be powers of two");
+
+EmuBatch::EmuBatch(size_t lanes)
+    : pc(lanes),
+      v_reg(NUM_REGS * lanes),
+      i_reg(lanes),
+      sp(lanes),
+      dt(lanes),
+      st(lanes),
+      stack(lanes * STACK_SIZE),
+      keys(lanes * NUM_KEYS),
+      ram(lanes * RAM_SIZE),
+      screen(lanes * SCREEN_HEIGHT),
+      rng(4 * lanes),
+      lanes(lanes),
+      ops(lanes),
+      decoded(RAM_SIZE),
+      instrs(lanes),
+      diverged(lanes),
+      order(lanes) {
+    reset();
+    std::random_device source;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        seed(lane, source());
+    }
+}
+
+size_t EmuBatch::size() const {
+    return lanes;
+}
+
+void EmuBatch::reset() {
+    std::fill(pc.begin(), pc.end(), START_ADDR);
+    std::fill(v_reg.begin(), v_reg.end(), 0);
+    std::fill(i_reg.begin(), i_reg.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(dt.begin(), dt.end(), 0);
+    std::fill(st.begin(), st.end(), 0);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(keys.begin(), keys.end(), 0);
+    std::fill(ram.begin(), ram.end(), 0);
+    std::fill(screen.begin(), screen.end(), 0);
+
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        std::copy(FONTSET, FONTSET + FONTSET_SIZE, &ram[lane * RAM_SIZE]);
+        std::copy(BIG_FONTSET, BIG_FONTSET + BIG_FONTSET_SIZE, &ram[lane * RAM_SIZE + BIG_FONT_ADDR]);
+    }
+}
+
+void EmuBatch::load(const uint8_t* data, size_t length) {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        load(lane, data, length);
+    }
+}
+
+void EmuBatch::load(size_t lane, const uint8_t* data, size_t length) {
+    // Like Emu::load, whatever does not fit below RAM_SIZE is dropped
+    size_t fits = std::min(length, RAM_SIZE - START_ADDR);
+    std::copy(data, data + fits, &ram[lane * RAM_SIZE + START_ADDR]);
+}
+
+void EmuBatch::keypress(size_t lane, size_t key, bool pressed) {
+    keys[lane * NUM_KEYS + key] = pressed;
+}
+
+void EmuBatch::seed(size_t lane, uint64_t value) {
+    Rng lane_rng;
+    lane_rng.seed(value);
+    for (size_t w = 0; w < 4; ++w) {
+        rng[w * lanes + lane] = lane_rng.s[w];
+    }
+}
+
+const uint64_t* EmuBatch::get_display(size_t lane) const {
+    return &screen[lane * SCREEN_HEIGHT];
+}
+
+void EmuBatch::set_lane(size_t lane, const Emu& emu) {
+    pc[lane] = emu.pc;
+    i_reg[lane] = emu.i_reg;
+    sp[lane] = emu.sp;
+    dt[lane] = emu.dt;
+    st[lane] = emu.st;
+    for (size_t r = 0; r < NUM_REGS; ++r) {
+        v_reg[r * lanes + lane] = emu.v_reg[r];
+    }
+    std::copy(emu.stack, emu.stack + STACK_SIZE, &stack[lane * STACK_SIZE]);
+    std::copy(emu.keys, emu.keys + NUM_KEYS, &keys[lane * NUM_KEYS]);
+    std::copy(emu.ram, emu.ram + RAM_SIZE, &ram[lane * RAM_SIZE]);
+    std::copy(emu.screen, emu.screen + SCREEN_HEIGHT, &screen[lane * SCREEN_HEIGHT]);
+    for (size_t w = 0; w < 4; ++w) {
+        rng[w * lanes + lane] = emu.rng.s[w];
+    }
+}
+
+void EmuBatch::get_lane(size_t lane, Emu& emu) const {
+    emu.pc = pc[lane];
+    emu.i_reg = i_reg[lane];
+    emu.sp = sp[lane];
+    emu.dt = dt[lane];
+    emu.st = st[lane];
+    for (size_t r = 0; r < NUM_REGS; ++r) {
+        emu.v_reg[r] = v_reg[r * lanes + lane];
+    }
+    std::copy(&stack[lane * STACK_SIZE], &stack[lane * STACK_SIZE] + STACK_SIZE, emu.stack);
+    for (size_t k = 0; k < NUM_KEYS; ++k) {
+        emu.keys[k] = keys[lane * NUM_KEYS + k] != 0;
+    }
+    std::copy(&ram[lane * RAM_SIZE], &ram[lane * RAM_SIZE] + RAM_SIZE, emu.ram);
+    emu.invalidate(0, RAM_SIZE);
+    std::copy(&screen[lane * SCREEN_HEIGHT], &screen[lane * SCREEN_HEIGHT] + SCREEN_HEIGHT, emu.screen);
+    emu.mark_display_dirty();
+    for (size_t w = 0; w < 4; ++w) {
+        emu.rng.s[w] = rng[w * lanes + lane];
+    }
+}
+
+void EmuBatch::tick_timers() {
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        dt[lane] -= dt[lane] > 0;
+        st[lane] -= st[lane] > 0;
+    }
+}
+
+uint16_t EmuBatch::fetch(size_t lane) const {
+    const uint8_t* mem = &ram[lane * RAM_SIZE];
+    return (mem[pc[lane] & ADDR_MASK] << 8) | mem[(pc[lane] + 1) & ADDR_MASK];
+}
+
+const Instr& EmuBatch::decode_at(uint16_t at, uint16_t op) {
+    Instr& slot = decoded[at & ADDR_MASK];
+    if (slot.opcode == Opcode::Undecoded || slot.op != op)
+        slot = decode_instr(op);
+    return slot;
+}
+
+size_t EmuBatch::step_all() {
+    size_t halted = 0;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        ops[lane] = fetch(lane);
+    }
+
+    size_t num_diverged = 0;
+    for (size_t first = 0; first < lanes; first += BATCH_GROUP) {
+        size_t last = std::min(first + BATCH_GROUP, lanes);
+        uint16_t op = ops[first];
+        bool shared = std::all_of(&ops[first], &ops[first] + (last - first),
+                                  [op](uint16_t other) { return other == op; });
+
+        if (shared) {
+            // One decode and one dispatch for the whole group
+            const Instr& in = decode_at(pc[first], op);
+            if (step_group(in, first, last))
+                continue;
+            for (size_t lane = first; lane < last; ++lane) {
+                halted += step_scalar(lane, in) == Status::Halted;
+            }
+            continue;
+        }
+
+        for (size_t lane = first; lane < last; ++lane) {
+            instrs[lane] = decode_at(pc[lane], ops[lane]);
+            diverged[num_diverged++] = uint32_t(lane);
+        }
+    }
+
+    if (num_diverged == 0)
+        return halted;
+
+    // The rest run one lane at a time, sorted by opcode so that consecutive
+    // lanes go through the same handler
+    std::array<uint32_t, size_t(Opcode::Count) + 1> starts{};
+    for (size_t i = 0; i < num_diverged; ++i) {
+        starts[size_t(instrs[diverged[i]].opcode) + 1]++;
+    }
+    for (size_t opcode = 1; opcode < starts.size(); ++opcode) {
+        starts[opcode] += starts[opcode - 1];
+    }
+    for (size_t i = 0; i < num_diverged; ++i) {
+        order[starts[size_t(instrs[diverged[i]].opcode)]++] = diverged[i];
+    }
+    for (size_t i = 0; i < num_diverged; ++i) {
+        halted += step_lane(order[i], instrs[order[i]]) == Status::Halted;
+    }
+    return halted;
+}
+
+bool EmuBatch::step_group(const Instr& in, size_t first, size_t last) {
+    uint8_t* vx = v(in.x);
+    uint8_t* vy = v(in.y);
+    uint8_t* vf = v(0xF);
+
+    // Each loop keeps the interpreter's per-lane statement order so VF
+    // aliasing Vx or Vy behaves the same as in Emu
+    switch (in.opcode) {
+        case Opcode::Nop:
+            break;
+        case Opcode::Jp:
+            for (size_t l = first; l < last; ++l) pc[l] = in.nnn;
+            return true;
+        case Opcode::SeVxNN:
+            for (size_t l = first; l < last; ++l) pc[l] += (vx[l] == in.nn) ? 4 : 2;
+            return true;
+        case Opcode::SneVxNN:
+            for (size_t l = first; l < last; ++l) pc[l] += (vx[l] != in.nn) ? 4 : 2;
+            return true;
+        case Opcode::SeVxVy:
+            for (size_t l = first; l < last; ++l) pc[l] += (vx[l] == vy[l]) ? 4 : 2;
+            return true;
+        case Opcode::SneVxVy:
+            for (size_t l = first; l < last; ++l) pc[l] += (vx[l] != vy[l]) ? 4 : 2;
+            return true;
+        case Opcode::LdVxNN:
+            for (size_t l = first; l < last; ++l) vx[l] = in.nn;
+            break;
+        case Opcode::AddVxNN:
+            for (size_t l = first; l < last; ++l) vx[l] += in.nn;
+            break;
+        case Opcode::LdVxVy:
+            for (size_t l = first; l < last; ++l) vx[l] = vy[l];
+            break;
+        case Opcode::Or:
+            for (size_t l = first; l < last; ++l) vx[l] |= vy[l];
+            break;
+        case Opcode::And:
+            for (size_t l = first; l < last; ++l) vx[l] &= vy[l];
+            break;
+        case Opcode::Xor:
+            for (size_t l = first; l < last; ++l) vx[l] ^= vy[l];
+            break;
+        case Opcode::AddVxVy:
+            for (size_t l = first; l < last; ++l) {
+                uint16_t sum = vx[l] + vy[l];
+                vf[l] = sum > 0xFF;
+                vx[l] = sum & 0xFF;
+            }
+            break;
+        case Opcode::Sub:
+            for (size_t l = first; l < last; ++l) {
+                vf[l] = vx[l] >= vy[l];
+                vx[l] = vx[l] - vy[l];
+            }
+            break;
+        case Opcode::Shr:
+            for (size_t l = first; l < last; ++l) {
+                vf[l] = vx[l] & 0x1;
+                vx[l] >>= 1;
+            }
+            break;
+        case Opcode::Subn:
+            for (size_t l = first; l < last; ++l) {
+                vf[l] = vy[l] >= vx[l];
+                vx[l] = vy[l] - vx[l];
+            }
+            break;
+        case Opcode::Shl:
+            for (size_t l = first; l < last; ++l) {
+                vf[l] = (vx[l] >> 7) & 0x1;
+                vx[l] <<= 1;
+            }
+            break;
+        case Opcode::LdI:
+            for (size_t l = first; l < last; ++l) i_reg[l] = in.nnn;
+            break;
+        case Opcode::AddIVx:
+            for (size_t l = first; l < last; ++l) i_reg[l] += vx[l];
+            break;
+        case Opcode::LdFVx:
+            for (size_t l = first; l < last; ++l) i_reg[l] = 5 * vx[l];
+            break;
+        case Opcode::LdVxDt:
+            for (size_t l = first; l < last; ++l) vx[l] = dt[l];
+            break;
+        case Opcode::LdDtVx:
+            for (size_t l = first; l < last; ++l) dt[l] = vx[l];
+            break;
+        case Opcode::LdStVx:
+            for (size_t l = first; l < last; ++l) st[l] = vx[l];
+            break;
+        case Opcode::Rnd:
+            rng_next_bytes(rng_word(0), rng_word(1), rng_word(2), rng_word(3), first, last, vx);
+            for (size_t l = first; l < last; ++l) vx[l] &= in.nn;
+            break;
+        default:
+            return false;
+    }
+    for (size_t l = first; l < last; ++l) pc[l] += 2;
+    return true;
+}
+
+Status EmuBatch::step_lane(size_t lane, const Instr& in) {
+    if (step_group(in, lane, lane + 1))
+        return Status::Ok;
+    return step_scalar(lane, in);
+}
+
+Status EmuBatch::step_scalar(size_t lane, const Instr& in) {
+    uint8_t* mem = &ram[lane * RAM_SIZE];
+    uint64_t* rows = &screen[lane * SCREEN_HEIGHT];
+    uint16_t* calls = &stack[lane * STACK_SIZE];
+    uint8_t& vx = v_reg[in.x * lanes + lane];
+    uint8_t& vy = v_reg[in.y * lanes + lane];
+    uint16_t& p = pc[lane];
+    uint16_t& i = i_reg[lane];
+
+    switch (in.opcode) {
+        case Opcode::Cls:
+            std::fill(rows, rows + SCREEN_HEIGHT, 0);
+            p += 2;
+            return Status::Ok;
+        case Opcode::Ret:
+            // Emu traps on a stack underflow or overflow, which halts here
+            if (sp[lane] == 0)
+                return Status::Halted;
+            sp[lane] -= 1;
+            p = calls[sp[lane] & STACK_MASK] + 2;
+            return Status::Ok;
+        case Opcode::Call:
+            if (sp[lane] >= STACK_SIZE)
+                return Status::Halted;
+            calls[sp[lane] & STACK_MASK] = p;
+            sp[lane] += 1;
+            p = in.nnn;
+            return Status::Ok;
+        case Opcode::JpV0:
+            p = v_reg[lane] + in.nnn;
+            return Status::Ok;
+        case Opcode::Drw: {
+            unsigned x_cord = vx % SCREEN_WIDTH;
+            uint16_t y_cord = vy;
+            uint8_t& vf = v_reg[0xF * lanes + lane];
+            vf = 0;
+            for (uint16_t row = 0; row < in.n; ++row) {
+                uint64_t pixels = uint64_t(mem[(i + row) & ADDR_MASK]) << 56;
+                pixels = (pixels >> x_cord) | (pixels << ((64 - x_cord) & 63));
+                uint64_t& line = rows[(y_cord + row) % SCREEN_HEIGHT];
+                if (line & pixels)
+                    vf = 1;
+                line ^= pixels;
+            }
+            p += 2;
+            return Status::Ok;
+        }
+        case Opcode::Skp:
+            p += keys[lane * NUM_KEYS + (vx & KEY_MASK)] ? 4 : 2;
+            return Status::Ok;
+        case Opcode::Sknp:
+            p += keys[lane * NUM_KEYS + (vx & KEY_MASK)] ? 2 : 4;
+            return Status::Ok;
+        case Opcode::LdVxK:
+            for (size_t k = 0; k < NUM_KEYS; ++k) {
+                if (keys[lane * NUM_KEYS + k]) {
+                    vx = k;
+                    p += 2;
+                    return Status::Ok;
+                }
+            }
+            return Status::Ok;
+        case Opcode::LdBVx: {
+            uint8_t value = vx;
+            mem[i & ADDR_MASK] = value / 100;
+            mem[(i + 1) & ADDR_MASK] = (value / 10) % 10;
+            mem[(i + 2) & ADDR_MASK] = value % 10;
+            p += 2;
+            return Status::Ok;
+        }
+        case Opcode::LdIVx:
+            for (size_t r = 0; r <= in.x; ++r) {
+                mem[(i + r) & ADDR_MASK] = v_reg[r * lanes + lane];
+            }
+            p += 2;
+            return Status::Ok;
+        case Opcode::LdVxI:
+            for (size_t r = 0; r <= in.x; ++r) {
+                v_reg[r * lanes + lane] = mem[(i + r) & ADDR_MASK];
+            }
+            p += 2;
+            return Status::Ok;
+        default:
+            // Unknown opcode: the lane stays on it, like Emu with TrapPolicy::Halt
+            return Status::Halted;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "core.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Lanes are checked for a shared opcode in groups of this many
+constexpr size_t BATCH_GROUP = 16;
+
+// N machines in structure-of-arrays layout, stepped in lock-step.
+// Per-register arrays are register-major (v_reg[r * size() + lane]) so a
+// group of lanes executing the same opcode touches contiguous memory and the
+// lane loops can be vectorized by the compiler (with AVX2 when configured
+// with CHIP8_BATCH_SIMD=ON). Groups that diverge run lane by lane, sorted by
+// opcode. Lanes always behave like QuirkProfile::Default and stay in low
+// resolution: set_lane() does not carry the quirks over, and a lane halts on
+// SUPER-CHIP and XO-CHIP opcodes like on unknown ones. Addresses, the stack pointer and key indices wrap
+// within the lane, so a misbehaving ROM cannot touch its neighbours.
+class EmuBatch {
+public:
+    explicit EmuBatch(size_t lanes);
+
+    size_t size() const;
+
+    void reset();
+
+    // Loads the same ROM into every lane
+    void load(const uint8_t* data, size_t length);
+
+    void load(size_t lane, const uint8_t* data, size_t length);
+
+    // Advances every lane by one instruction. Returns how many lanes are
+    // stopped on an unknown opcode; those lanes keep pc where it is.
+    size_t step_all();
+
+    void tick_timers();
+
+    void keypress(size_t lane, size_t key, bool pressed);
+
+    // Makes CXNN deterministic for one lane
+    void seed(size_t lane, uint64_t value);
+
+    const uint64_t* get_display(size_t lane) const;
+
+    // Moves one lane to and from a standalone Emu
+    void set_lane(size_t lane, const Emu& emu);
+    void get_lane(size_t lane, Emu& emu) const;
+
+    std::vector<uint16_t> pc;
+    std::vector<uint8_t> v_reg;     // NUM_REGS * lanes, register-major
+    std::vector<uint16_t> i_reg;
+    std::vector<uint16_t> sp;
+    std::vector<uint8_t> dt;
+    std::vector<uint8_t> st;
+    std::vector<uint16_t> stack;    // lanes * STACK_SIZE
+    std::vector<uint8_t> keys;      // lanes * NUM_KEYS
+    std::vector<uint8_t> ram;       // lanes * RAM_SIZE
+    std::vector<uint64_t> screen;   // lanes * SCREEN_HEIGHT
+    std::vector<uint32_t> rng;      // 4 * lanes, word-major like v_reg
+
+private:
+    uint8_t* v(size_t reg) { return &v_reg[reg * lanes]; }
+
+    uint16_t fetch(size_t lane) const;
+
+    // op as fetched at pc, decoded through a cache shared by every lane:
+    // lanes mostly run the same ROM, and a slot holding another op is
+    // decoded again
+    const Instr& decode_at(uint16_t at, uint16_t op);
+
+    // Runs instr on lanes [first, last), which all fetched the same opcode.
+    // Returns false if the opcode has no group implementation.
+    bool step_group(const Instr& in, size_t first, size_t last);
+
+    // The opcodes step_group() does not take, for one lane
+    Status step_scalar(size_t lane, const Instr& in);
+
+    Status step_lane(size_t lane, const Instr& in);
+
+    uint32_t* rng_word(size_t word) { return &rng[word * lanes]; }
+
+    size_t lanes;
+    std::vector<uint16_t> ops;
+    std::vector<Instr> decoded;     // RAM_SIZE, see decode_at()
+    std::vector<Instr> instrs;      // per lane, for those that diverged
+    std::vector<uint32_t> diverged; // lanes in groups without a shared opcode
+    std::vector<uint32_t> order;    // the same sorted by opcode
+};
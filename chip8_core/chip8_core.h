@@ -0,0 +1,14 @@
+#pragma once
+
+// Everything the chip8_core library exports. Frontends can include this or
+// just the headers they need.
+
+#include "core.h"
+#include "state.h"
+#include "rewind.h"
+#include "runner.h"
+#include "batch.h"
+#include "jit.h"
+#include "aot.h"
+#include "trace.h"
+#include "audio.h"
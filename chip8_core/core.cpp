@@ -1,7 +1,10 @@
 #include "core.h"
+#include "trace.h"
 
 #include <algorithm>
+#include <array>
 #include <iterator>
+#include <cstring>
 #include <random>
 
 // Define FONTSET here (extern const in header)
@@ -24,43 +27,403 @@ const uint8_t FONTSET[FONTSET_SIZE] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+const uint8_t BIG_FONTSET[BIG_FONTSET_SIZE] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+static inline uint64_t rotr64(uint64_t value, unsigned shift) {
+    return (value >> shift) | (value << ((64 - shift) & 63));
+}
+
 // Simple add function
 uint64_t add(uint64_t left, uint64_t right){
     return left + right;
 }
 
 // Constructor
-Emu::Emu() : pc(START_ADDR), i_reg(0), sp(0), dt(0), st(0) {
+Emu::Emu() : Emu(std::random_device{}()) {}
+
+Emu::Emu(uint64_t seed_value)
+    : pc(START_ADDR), hires(false), plane_mask(1), pitch(DEFAULT_PITCH), i_reg(0), sp(0), dt(0), st(0),
+      high_ram_dirty(false), tracer(nullptr), display_gen(0), dirty_rows(~uint64_t(0) >> (64 - SCREEN_HEIGHT)),
+      quirks(QuirkProfile::Default), trap_from(Opcode::LdILong),
+      trap_policy(TrapPolicy::Halt), trap_hook(nullptr), trap_user(nullptr) {
     std::fill(ram, ram + RAM_SIZE, 0);
-    std::fill(screen, screen + (SCREEN_WIDTH * SCREEN_HEIGHT), false);
+    std::fill(screen, screen + SCREEN_HEIGHT, 0);
+    std::fill(hires_screen, hires_screen + HIRES_HEIGHT * HIRES_ROW_WORDS, 0);
+    std::fill(rpl, rpl + NUM_REGS, 0);
+    std::fill(audio_pattern, audio_pattern + AUDIO_PATTERN_SIZE, 0);
     std::fill(v_reg, v_reg + NUM_REGS, 0);
     std::fill(stack, stack + STACK_SIZE, 0);
     std::fill(keys, keys + NUM_KEYS, false);
+    std::fill(icache, icache + RAM_SIZE, Instr{});
+    dirty_pages = uint16_t(~0u);
+    seed(seed_value);
 
     std::copy(FONTSET, FONTSET + FONTSET_SIZE, ram);
+    std::copy(BIG_FONTSET, BIG_FONTSET + BIG_FONTSET_SIZE, ram + BIG_FONT_ADDR);
 }
 
 void Emu::reset() {
-    *this = Emu();
+    Tracer* attached = tracer;
+    QuirkProfile profile = quirks;
+    TrapPolicy policy = trap_policy;
+    TrapHook hook = trap_hook;
+    void* user = trap_user;
+    *this = Emu(rng_seed);
+    tracer = attached;
+    set_quirks(profile);
+    set_trap_policy(policy, hook, user);
 }
 
+void Emu::seed(uint64_t value) {
+    rng_seed = value;
+    rng.seed(value);
+}
+
+static_assert((STACK_SIZE & (STACK_SIZE - 1)) == 0, "push() and pop() mask sp into the stack");
+
 void Emu::push(uint16_t val) {
-    stack[sp] = val;
+    stack[sp & (STACK_SIZE - 1)] = val;
     sp += 1;
 }
 
 uint16_t Emu::pop() {
     sp -= 1;
-    return stack[sp];
+    return stack[sp & (STACK_SIZE - 1)];
 }
 
-void Emu::tick() {
-    uint16_t op = fetch();
-    execute(op);
+bool Emu::stack_fault(const Instr& in) const {
+    return (in.opcode == Opcode::Call && sp >= STACK_SIZE) || (in.opcode == Opcode::Ret && sp == 0);
 }
 
-const bool* Emu::get_display() const {
-    return screen;
+Status Emu::tick() {
+    if (pc >= RAM_SIZE)
+        return execute(fetch());
+    Instr& instr = icache[pc];
+    if (instr.opcode == Opcode::Undecoded)
+        instr = decode_instr(fetch());
+    return dispatch(instr);
+}
+
+// The same handlers as HANDLERS<Q>, as a switch so that run_loop() can
+// inline them and jump straight to each one. Keep the two in step, stack
+// faults included.
+template <class Q>
+inline Status Emu::exec(const Instr& in) {
+    switch (in.opcode) {
+        case Opcode::Nop: op_nop(in); break;
+        case Opcode::Cls: op_cls(in); break;
+        case Opcode::Ret:
+            if (sp == 0)
+                return trap(in);
+            op_ret(in);
+            break;
+        case Opcode::Jp: op_jp(in); break;
+        case Opcode::Call:
+            if (sp >= STACK_SIZE)
+                return trap(in);
+            op_call(in);
+            break;
+        case Opcode::SeVxNN: op_se_vx_nn<Q>(in); break;
+        case Opcode::SneVxNN: op_sne_vx_nn<Q>(in); break;
+        case Opcode::SeVxVy: op_se_vx_vy<Q>(in); break;
+        case Opcode::LdVxNN: op_ld_vx_nn(in); break;
+        case Opcode::AddVxNN: op_add_vx_nn(in); break;
+        case Opcode::LdVxVy: op_ld_vx_vy(in); break;
+        case Opcode::Or: op_or<Q>(in); break;
+        case Opcode::And: op_and<Q>(in); break;
+        case Opcode::Xor: op_xor<Q>(in); break;
+        case Opcode::AddVxVy: op_add_vx_vy(in); break;
+        case Opcode::Sub: op_sub(in); break;
+        case Opcode::Shr: op_shr<Q>(in); break;
+        case Opcode::Subn: op_subn(in); break;
+        case Opcode::Shl: op_shl<Q>(in); break;
+        case Opcode::SneVxVy: op_sne_vx_vy<Q>(in); break;
+        case Opcode::LdI: op_ld_i(in); break;
+        case Opcode::JpV0: op_jp_v0<Q>(in); break;
+        case Opcode::Rnd: op_rnd(in); break;
+        case Opcode::Drw: op_drw<Q>(in); break;
+        case Opcode::Skp: op_skp<Q>(in); break;
+        case Opcode::Sknp: op_sknp<Q>(in); break;
+        case Opcode::LdVxDt: op_ld_vx_dt(in); break;
+        case Opcode::LdVxK: op_ld_vx_k(in); break;
+        case Opcode::LdDtVx: op_ld_dt_vx(in); break;
+        case Opcode::LdStVx: op_ld_st_vx(in); break;
+        case Opcode::AddIVx: op_add_i_vx(in); break;
+        case Opcode::LdFVx: op_ld_f_vx(in); break;
+        case Opcode::LdBVx: op_ld_b_vx<Q>(in); break;
+        case Opcode::LdIVx: op_ld_i_vx<Q>(in); break;
+        case Opcode::LdVxI: op_ld_vx_i<Q>(in); break;
+        case Opcode::Scd: op_scd(in); break;
+        case Opcode::Scr: op_scr(in); break;
+        case Opcode::Scl: op_scl(in); break;
+        case Opcode::Exit: op_exit(in); break;
+        case Opcode::Low: op_low(in); break;
+        case Opcode::High: op_high(in); break;
+        case Opcode::LdHfVx: op_ld_hf_vx(in); break;
+        case Opcode::LdRVx: op_ld_r_vx(in); break;
+        case Opcode::LdVxR: op_ld_vx_r(in); break;
+        case Opcode::LdILong: op_ld_i_long(in); break;
+        case Opcode::SaveRange: op_save_range(in); break;
+        case Opcode::LoadRange: op_load_range(in); break;
+        case Opcode::Plane: op_plane(in); break;
+        case Opcode::Audio: op_audio(in); break;
+        case Opcode::Pitch: op_pitch(in); break;
+        case Opcode::Scu: op_scu(in); break;
+        default: break;  // Undecoded and Unknown never get here
+    }
+    return Status::Ok;
+}
+
+static_assert(static_cast<size_t>(Opcode::Count) <= 64, "run_loop keeps one bit per opcode");
+
+// Opcodes after which run() returns StopReason::Draw
+constexpr uint64_t DRAW_OPCODES =
+    (uint64_t(1) << static_cast<unsigned>(Opcode::Cls)) | (uint64_t(1) << static_cast<unsigned>(Opcode::Drw));
+
+// Opcodes that leave the machine unchanged when they leave pc where it was,
+// so the rest of the frame would repeat them for nothing: 1NNN to itself,
+// FX0A with no key held and 00FD
+constexpr uint64_t WAIT_OPCODES = (uint64_t(1) << static_cast<unsigned>(Opcode::Jp))
+    | (uint64_t(1) << static_cast<unsigned>(Opcode::LdVxK)) | (uint64_t(1) << static_cast<unsigned>(Opcode::Exit));
+
+template <class Q, bool whole_frame>
+RunResult Emu::run_loop(uint32_t max_instructions) {
+    RunResult result{0, StopReason::Budget, Status::Ok, 0};
+    // Opcodes that go through dispatch() and the stop checks, one bit each:
+    // those the profile traps, the draws for run(), everything when tracing
+    constexpr Opcode trap_at = Q::xo_chip ? Opcode::Unknown : Opcode::LdILong;
+    uint64_t slow = ~uint64_t(0) << static_cast<unsigned>(trap_at);
+    if constexpr (!whole_frame)
+        slow |= DRAW_OPCODES;
+    if constexpr (TRACE_ENABLED) {
+        if (tracer)
+            slow = ~uint64_t(0);
+    }
+
+    uint32_t cycles = 0;
+    while (cycles < max_instructions) {
+        uint16_t at = pc;
+        Instr uncached;
+        const Instr* in = &uncached;
+        if (at < RAM_SIZE) {
+            Instr& slot = icache[at];
+            if (slot.opcode == Opcode::Undecoded)
+                slot = decode_instr(fetch());
+            in = &slot;
+        } else {
+            uncached = decode_instr(fetch());
+        }
+        // The handler may invalidate its own cache slot, e.g. FX55 over itself
+        Opcode opcode = in->opcode;
+        cycles++;
+
+        bool slow_path = (slow >> static_cast<unsigned>(opcode)) & 1;
+        Status status = slow_path ? dispatch(*in) : exec<Q>(*in);
+        if (status == Status::Trapped) {
+            result.traps++;
+            if constexpr (!whole_frame) {
+                result.status = status;
+                result.stop = StopReason::Trap;
+                break;
+            }
+        } else if (status == Status::Halted) {
+            result.status = status;
+            result.stop = StopReason::Trap;
+            break;
+        }
+        if constexpr (!whole_frame) {
+            if (slow_path && (opcode == Opcode::Drw || opcode == Opcode::Cls)) {
+                result.stop = StopReason::Draw;
+                break;
+            }
+        }
+
+        // Not any pc == at: a 00EE returning to itself pops, a trap hook may count
+        if (pc == at && ((WAIT_OPCODES >> static_cast<unsigned>(opcode)) & 1)) {
+            result.stop = StopReason::Wait;
+            break;
+        }
+    }
+    result.cycles = cycles;
+    return result;
+}
+
+template <bool whole_frame>
+RunResult Emu::run_profile(uint32_t max_instructions) {
+    switch (quirks) {
+        case QuirkProfile::CosmacVip: return run_loop<QuirksCosmacVip, whole_frame>(max_instructions);
+        case QuirkProfile::SuperChip: return run_loop<QuirksSuperChip, whole_frame>(max_instructions);
+        case QuirkProfile::XoChip:    return run_loop<QuirksXoChip, whole_frame>(max_instructions);
+        default:                      return run_loop<QuirksDefault, whole_frame>(max_instructions);
+    }
+}
+
+RunResult Emu::run(uint32_t max_instructions) {
+    return run_profile<false>(max_instructions);
+}
+
+RunResult Emu::run_frame() {
+    RunResult frame = run_profile<true>(TICKS_PER_FRAME);
+    if (frame.status != Status::Halted && frame.traps > 0)
+        frame.status = Status::Trapped;
+    tick_timers();
+    return frame;
+}
+
+void Emu::set_quirks(QuirkProfile profile) {
+    quirks = profile < QuirkProfile::Count ? profile : QuirkProfile::Default;
+    if (quirks == QuirkProfile::XoChip) {
+        trap_from = Opcode::Unknown;
+        high_ram.resize(XO_RAM_SIZE - RAM_SIZE);
+        high_ram_dirty = true;
+        extra_planes.resize((NUM_PLANES - 1) * PLANE_WORDS);
+    } else {
+        trap_from = Opcode::LdILong;
+        std::vector<uint8_t>().swap(high_ram);
+        std::vector<uint64_t>().swap(extra_planes);
+        plane_mask = 1;
+    }
+}
+
+size_t Emu::memory_size() const {
+    return RAM_SIZE + high_ram.size();
+}
+
+uint8_t Emu::peek(size_t addr) const {
+    if (addr < RAM_SIZE)
+        return ram[addr];
+    return addr - RAM_SIZE < high_ram.size() ? high_ram[addr - RAM_SIZE] : 0;
+}
+
+static const char* const QUIRK_PROFILE_NAMES[static_cast<size_t>(QuirkProfile::Count)] = {
+    "default", "vip", "schip", "xochip",
+};
+
+bool parse_quirk_profile(const char* name, QuirkProfile& out) {
+    for (size_t i = 0; i < static_cast<size_t>(QuirkProfile::Count); ++i) {
+        if (std::strcmp(name, QUIRK_PROFILE_NAMES[i]) == 0) {
+            out = static_cast<QuirkProfile>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* quirk_profile_name(QuirkProfile profile) {
+    size_t i = static_cast<size_t>(profile);
+    return i < static_cast<size_t>(QuirkProfile::Count) ? QUIRK_PROFILE_NAMES[i] : "unknown";
+}
+
+static bool has_extension(const char* path, const char* ext) {
+    size_t path_length = std::strlen(path);
+    size_t length = std::strlen(ext);
+    return path_length >= length && std::strcmp(path + path_length - length, ext) == 0;
+}
+
+QuirkProfile profile_for(const char* path) {
+    if (has_extension(path, ".xo8"))
+        return QuirkProfile::XoChip;
+    if (has_extension(path, ".sc8"))
+        return QuirkProfile::SuperChip;
+    return QuirkProfile::Default;
+}
+
+void Emu::set_trap_policy(TrapPolicy policy, TrapHook hook, void* user) {
+    trap_policy = policy;
+    trap_hook = hook;
+    trap_user = user;
+}
+
+size_t Emu::num_planes() const {
+    return extra_planes.empty() ? 1 : NUM_PLANES;
+}
+
+const uint64_t* Emu::get_plane(size_t plane) const {
+    if (plane == 0)
+        return get_display();
+    return plane < num_planes() ? &extra_planes[(plane - 1) * PLANE_WORDS] : nullptr;
+}
+
+uint64_t* Emu::plane_rows(size_t plane) {
+    if (plane == 0)
+        return hires ? hires_screen : screen;
+    return &extra_planes[(plane - 1) * PLANE_WORDS];
+}
+
+void Emu::clear_planes() {
+    std::fill(screen, screen + SCREEN_HEIGHT, 0);
+    std::fill(hires_screen, hires_screen + PLANE_WORDS, 0);
+    std::fill(extra_planes.begin(), extra_planes.end(), 0);
+}
+
+uint8_t Emu::get_color(size_t x, size_t y) const {
+    size_t words = display_width() / 64;
+    size_t at = y * words + x / 64;
+    unsigned shift = 63 - x % 64;
+    uint8_t color = 0;
+    for (size_t p = 0; p < num_planes(); ++p) {
+        color |= ((get_plane(p)[at] >> shift) & 1) << p;
+    }
+    return color;
+}
+
+const uint64_t* Emu::get_display() const {
+    return hires ? hires_screen : screen;
+}
+
+size_t Emu::display_width() const {
+    return hires ? HIRES_WIDTH : SCREEN_WIDTH;
+}
+
+size_t Emu::display_height() const {
+    return hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+}
+
+void Emu::unpack_display(bool* out) const {
+    for (size_t y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (size_t x = 0; x < SCREEN_WIDTH; ++x) {
+            bool lit = get_pixel(x, y);
+            if (hires) {
+                lit = get_pixel(2 * x, 2 * y) || get_pixel(2 * x + 1, 2 * y)
+                    || get_pixel(2 * x, 2 * y + 1) || get_pixel(2 * x + 1, 2 * y + 1);
+            }
+            out[x + SCREEN_WIDTH * y] = lit;
+        }
+    }
+}
+
+bool Emu::get_pixel(size_t x, size_t y) const {
+    if (hires)
+        return (hires_screen[y * HIRES_ROW_WORDS + x / 64] >> (63 - x % 64)) & 1;
+    return (screen[y] >> (SCREEN_WIDTH - 1 - x)) & 1;
+}
+
+uint64_t Emu::take_dirty_rows() {
+    uint64_t rows = dirty_rows;
+    dirty_rows = 0;
+    return rows;
+}
+
+void Emu::mark_display_dirty() {
+    dirty_rows = ~uint64_t(0) >> (64 - display_height());
+    display_gen++;
 }
 
 void Emu::keypress(size_t key, bool pressed) {
@@ -69,307 +432,907 @@ void Emu::keypress(size_t key, bool pressed) {
 
 void Emu::load(const uint8_t* data, size_t length) {
     size_t start = START_ADDR;
-    for (size_t i = 0; i < length; ++i) {
+    size_t low = std::min(length, RAM_SIZE - start);
+    for (size_t i = 0; i < low; ++i) {
         ram[start + i] = data[i];
     }
+    invalidate(start, low);
+    // Only XO-CHIP has anywhere to put the rest
+    size_t high = std::min(length - low, high_ram.size());
+    std::copy(data + low, data + low + high, high_ram.begin());
+    if (high > 0)
+        high_ram_dirty = true;
 }
 
-void Emu::execute(uint16_t op) {
-    printf("PC: 0x%03X, Opcode: 0x%04X\n", pc, op);
+void Emu::invalidate(size_t addr, size_t length) {
+    // Writes through I wrap around to the start of memory
+    size_t size = memory_size();
+    addr &= size - 1;
+    if (addr + length > size) {
+        invalidate(0, addr + length - size);
+        length = size - addr;
+    }
+    if (addr + length > RAM_SIZE)
+        high_ram_dirty = true;
+    // The instruction starting one byte earlier also covers addr
+    size_t first = addr > 0 ? addr - 1 : 0;
+    size_t last = std::min(addr + length, RAM_SIZE);
+    for (size_t i = first; i < last; ++i) {
+        icache[i].opcode = Opcode::Undecoded;
+    }
+    if (length == 0 || addr >= RAM_SIZE)
+        return;
+    for (size_t page = addr / RAM_PAGE_SIZE; page <= (last - 1) / RAM_PAGE_SIZE; ++page) {
+        dirty_pages |= uint16_t(1u << page);
+    }
+}
 
+// Reference decoder: walks the opcode nibbles the same way the original interpreter did
+static Opcode decode_branch(uint16_t op) {
     uint16_t digit1 = (op & 0xF000) >> 12;
     uint16_t digit2 = (op & 0x0F00) >> 8;
     uint16_t digit3 = (op & 0x00F0) >> 4;
     uint16_t digit4 = op & 0x000F;
 
-    if (op == 0x0000) {
-        // NOP
-        pc += 2;
-        return;
-    }
+    if (op == 0x0000)
+        return Opcode::Nop;
 
     if (digit1 == 0x0) {
-        if (digit2 == 0 && digit3 == 0xE && digit4 == 0) {
-            // 00E0 CLS
-            std::fill(screen, screen + (SCREEN_WIDTH * SCREEN_HEIGHT), false);
-            pc += 2;
-            return;
-        }
-        else if (digit2 == 0 && digit3 == 0xE && digit4 == 0xE) {
-            // 00EE RET
-            pc = pop();
-            pc += 2;
-            return;
-        }
-        else {
-            throw std::runtime_error("Unknown 0x0 opcode");
+        if (digit2 == 0 && digit3 == 0xE && digit4 == 0)
+            return Opcode::Cls;
+        else if (digit2 == 0 && digit3 == 0xE && digit4 == 0xE)
+            return Opcode::Ret;
+        else if (digit2 == 0 && digit3 == 0xC)
+            return Opcode::Scd;
+        else if (digit2 == 0 && digit3 == 0xD)
+            return Opcode::Scu;
+        else if (digit2 == 0 && digit3 == 0xF) {
+            switch (digit4) {
+                case 0xB: return Opcode::Scr;
+                case 0xC: return Opcode::Scl;
+                case 0xD: return Opcode::Exit;
+                case 0xE: return Opcode::Low;
+                case 0xF: return Opcode::High;
+                default:  return Opcode::Unknown;
+            }
         }
-    }
-    else if (digit1 == 0x1) {
-        // 1NNN JP addr
-        pc = op & 0x0FFF;
-        return;
-    }
-    else if (digit1 == 0x2) {
-        // 2NNN CALL addr
-        push(pc);
-        pc = op & 0x0FFF;
-        return;
-    }
-    else if (digit1 == 0x3) {
-        // 3XNN SE Vx, byte
-        size_t x = digit2;
-        uint8_t nn = op & 0x00FF;
-        if (v_reg[x] == nn)
-            pc += 4;
         else
-            pc += 2;
-        return;
+            return Opcode::Unknown;
     }
-    else if (digit1 == 0x4) {
-        // 4XNN SNE Vx, byte
-        size_t x = digit2;
-        uint8_t nn = op & 0x00FF;
-        if (v_reg[x] != nn)
-            pc += 4;
+    else if (digit1 == 0x1)
+        return Opcode::Jp;
+    else if (digit1 == 0x2)
+        return Opcode::Call;
+    else if (digit1 == 0x3)
+        return Opcode::SeVxNN;
+    else if (digit1 == 0x4)
+        return Opcode::SneVxNN;
+    else if (digit1 == 0x5 && digit4 == 0)
+        return Opcode::SeVxVy;
+    else if (digit1 == 0x5 && digit4 == 2)
+        return Opcode::SaveRange;
+    else if (digit1 == 0x5 && digit4 == 3)
+        return Opcode::LoadRange;
+    else if (digit1 == 0x6)
+        return Opcode::LdVxNN;
+    else if (digit1 == 0x7)
+        return Opcode::AddVxNN;
+    else if (digit1 == 0x8) {
+        if (digit4 == 0x0)
+            return Opcode::LdVxVy;
+        else if (digit4 == 0x1)
+            return Opcode::Or;
+        else if (digit4 == 0x2)
+            return Opcode::And;
+        else if (digit4 == 0x3)
+            return Opcode::Xor;
+        else if (digit4 == 0x4)
+            return Opcode::AddVxVy;
+        else if (digit4 == 0x5)
+            return Opcode::Sub;
+        else if (digit4 == 0x6)
+            return Opcode::Shr;
+        else if (digit4 == 0x7)
+            return Opcode::Subn;
+        else if (digit4 == 0xE)
+            return Opcode::Shl;
         else
-            pc += 2;
-        return;
+            return Opcode::Unknown;
     }
-    else if (digit1 == 0x5 && digit4 == 0) {
-        // 5XY0 SE Vx, Vy
-        size_t x = digit2;
-        size_t y = digit3;
-        if (v_reg[x] == v_reg[y])
-            pc += 4;
+    else if (digit1 == 0x9 && digit4 == 0)
+        return Opcode::SneVxVy;
+    else if (digit1 == 0xA)
+        return Opcode::LdI;
+    else if (digit1 == 0xB)
+        return Opcode::JpV0;
+    else if (digit1 == 0xC)
+        return Opcode::Rnd;
+    else if (digit1 == 0xD)
+        return Opcode::Drw;
+    else if (digit1 == 0xE) {
+        if (digit3 == 0x9 && digit4 == 0xE)
+            return Opcode::Skp;
+        else if (digit3 == 0xA && digit4 == 0x1)
+            return Opcode::Sknp;
         else
-            pc += 2;
-        return;
+            return Opcode::Unknown;
     }
-    else if (digit1 == 0x6) {
-        // 6XNN LD Vx, byte
-        size_t x = digit2;
-        v_reg[x] = op & 0x00FF;
-        pc += 2;
-        return;
+    else if (digit1 == 0xF) {
+        if (op == 0xF000)
+            return Opcode::LdILong;
+        if (op == 0xF002)
+            return Opcode::Audio;
+        uint8_t last_two = (digit3 << 4) | digit4;
+        switch (last_two) {
+            case 0x01: return Opcode::Plane;
+            case 0x07: return Opcode::LdVxDt;
+            case 0x0A: return Opcode::LdVxK;
+            case 0x15: return Opcode::LdDtVx;
+            case 0x18: return Opcode::LdStVx;
+            case 0x1E: return Opcode::AddIVx;
+            case 0x29: return Opcode::LdFVx;
+            case 0x30: return Opcode::LdHfVx;
+            case 0x33: return Opcode::LdBVx;
+            case 0x3A: return Opcode::Pitch;
+            case 0x55: return Opcode::LdIVx;
+            case 0x65: return Opcode::LdVxI;
+            case 0x75: return Opcode::LdRVx;
+            case 0x85: return Opcode::LdVxR;
+            default:   return Opcode::Unknown;
+        }
     }
-    else if (digit1 == 0x7) {
-        // 7XNN ADD Vx, byte
-        size_t x = digit2;
-        v_reg[x] = v_reg[x] + (op & 0x00FF);
-        pc += 2;
-        return;
+    return Opcode::Unknown;
+}
+
+#if CHIP8_TABLE_DISPATCH
+// One byte per possible opcode, filled from decode_branch so both paths always agree
+static const std::array<Opcode, 0x10000> OPCODE_TABLE = [] {
+    std::array<Opcode, 0x10000> table{};
+    for (uint32_t op = 0; op < table.size(); ++op) {
+        table[op] = decode_branch(static_cast<uint16_t>(op));
     }
-    else if (digit1 == 0x8) {
-        size_t x = digit2;
-        size_t y = digit3;
+    return table;
+}();
+#endif
 
-        if (digit4 == 0x0)
-            v_reg[x] = v_reg[y];
-        else if (digit4 == 0x1)
-            v_reg[x] |= v_reg[y];
-        else if (digit4 == 0x2)
-            v_reg[x] &= v_reg[y];
-        else if (digit4 == 0x3)
-            v_reg[x] ^= v_reg[y];
-        else if (digit4 == 0x4) {
-            uint16_t sum = v_reg[x] + v_reg[y];
-            v_reg[0xF] = (sum > 0xFF) ? 1 : 0;
-            v_reg[x] = sum & 0xFF;
-        }
-        else if (digit4 == 0x5) {
-            v_reg[0xF] = (v_reg[x] >= v_reg[y]) ? 1 : 0;
-            v_reg[x] = v_reg[x] - v_reg[y];
-        }
-        else if (digit4 == 0x6) {
-            v_reg[0xF] = v_reg[x] & 0x1;
-            v_reg[x] >>= 1;
-        }
-        else if (digit4 == 0x7) {
-            v_reg[0xF] = (v_reg[y] >= v_reg[x]) ? 1 : 0;
-            v_reg[x] = v_reg[y] - v_reg[x];
-        }
-        else if (digit4 == 0xE) {
-            v_reg[0xF] = (v_reg[x] >> 7) & 0x1;
-            v_reg[x] <<= 1;
-        }
-        else {
-            throw std::runtime_error("Unknown 8XYN opcode");
+Opcode decode(uint16_t op) {
+#if CHIP8_TABLE_DISPATCH
+    return OPCODE_TABLE[op];
+#else
+    return decode_branch(op);
+#endif
+}
+
+Instr decode_instr(uint16_t op) {
+    Instr in;
+    in.opcode = decode(op);
+    in.x = (op & 0x0F00) >> 8;
+    in.y = (op & 0x00F0) >> 4;
+    in.n = op & 0x000F;
+    in.nn = op & 0x00FF;
+    in.nnn = op & 0x0FFF;
+    in.op = op;
+    return in;
+}
+
+// Indexed by Opcode, order must match the enum in core.h
+template <class Q>
+const Emu::Handler Emu::HANDLERS[static_cast<size_t>(Opcode::Count)] = {
+    &Emu::op_nop,  // Undecoded never reaches dispatch
+    &Emu::op_nop,
+    &Emu::op_cls,
+    &Emu::op_ret,
+    &Emu::op_jp,
+    &Emu::op_call,
+    &Emu::op_se_vx_nn<Q>,
+    &Emu::op_sne_vx_nn<Q>,
+    &Emu::op_se_vx_vy<Q>,
+    &Emu::op_ld_vx_nn,
+    &Emu::op_add_vx_nn,
+    &Emu::op_ld_vx_vy,
+    &Emu::op_or<Q>,
+    &Emu::op_and<Q>,
+    &Emu::op_xor<Q>,
+    &Emu::op_add_vx_vy,
+    &Emu::op_sub,
+    &Emu::op_shr<Q>,
+    &Emu::op_subn,
+    &Emu::op_shl<Q>,
+    &Emu::op_sne_vx_vy<Q>,
+    &Emu::op_ld_i,
+    &Emu::op_jp_v0<Q>,
+    &Emu::op_rnd,
+    &Emu::op_drw<Q>,
+    &Emu::op_skp<Q>,
+    &Emu::op_sknp<Q>,
+    &Emu::op_ld_vx_dt,
+    &Emu::op_ld_vx_k,
+    &Emu::op_ld_dt_vx,
+    &Emu::op_ld_st_vx,
+    &Emu::op_add_i_vx,
+    &Emu::op_ld_f_vx,
+    &Emu::op_ld_b_vx<Q>,
+    &Emu::op_ld_i_vx<Q>,
+    &Emu::op_ld_vx_i<Q>,
+    &Emu::op_scd,
+    &Emu::op_scr,
+    &Emu::op_scl,
+    &Emu::op_exit,
+    &Emu::op_low,
+    &Emu::op_high,
+    &Emu::op_ld_hf_vx,
+    &Emu::op_ld_r_vx,
+    &Emu::op_ld_vx_r,
+    &Emu::op_ld_i_long,
+    &Emu::op_save_range,
+    &Emu::op_load_range,
+    &Emu::op_plane,
+    &Emu::op_audio,
+    &Emu::op_pitch,
+    &Emu::op_scu,
+    &Emu::op_nop,  // Unknown is sent to trap() before the table
+};
+
+const Emu::Handler* const Emu::HANDLER_TABLES[static_cast<size_t>(QuirkProfile::Count)] = {
+    HANDLERS<QuirksDefault>,
+    HANDLERS<QuirksCosmacVip>,
+    HANDLERS<QuirksSuperChip>,
+    HANDLERS<QuirksXoChip>,
+};
+
+Status Emu::execute(uint16_t op) {
+    return dispatch(decode_instr(op));
+}
+
+Status Emu::execute(const Instr& in) {
+    if (in.opcode >= trap_from || stack_fault(in))
+        return trap(in);
+    switch (quirks) {
+        case QuirkProfile::CosmacVip: return exec<QuirksCosmacVip>(in);
+        case QuirkProfile::SuperChip: return exec<QuirksSuperChip>(in);
+        case QuirkProfile::XoChip:    return exec<QuirksXoChip>(in);
+        default:                      return exec<QuirksDefault>(in);
+    }
+}
+
+Status Emu::dispatch(const Instr& in) {
+    if (in.opcode >= trap_from || stack_fault(in))
+        return trap(in);
+    const Handler* table = HANDLER_TABLES[static_cast<size_t>(quirks)];
+    if constexpr (TRACE_ENABLED) {
+        if (tracer) {
+            uint16_t fetched_at = pc;
+            uint8_t before[NUM_REGS];
+            std::copy(v_reg, v_reg + NUM_REGS, before);
+            (this->*table[static_cast<size_t>(in.opcode)])(in);
+            tracer->record(fetched_at, in.op, i_reg, before, v_reg);
+            return Status::Ok;
         }
-        pc += 2;
-        return;
     }
-    else if (digit1 == 0x9 && digit4 == 0) {
-        // 9XY0 SNE Vx, Vy
-        size_t x = digit2;
-        size_t y = digit3;
-        if (v_reg[x] != v_reg[y])
-            pc += 4;
-        else
+    (this->*table[static_cast<size_t>(in.opcode)])(in);
+    return Status::Ok;
+}
+
+Status Emu::trap(const Instr& in) {
+    switch (trap_policy) {
+        case TrapPolicy::Skip:
             pc += 2;
-        return;
-    }
-    else if (digit1 == 0xA) {
-        // ANNN LD I, addr
-        i_reg = op & 0x0FFF;
-        pc += 2;
-        return;
+            return Status::Trapped;
+        case TrapPolicy::Nop:
+            pc += 2;
+            return Status::Ok;
+        case TrapPolicy::Hook:
+            if (trap_hook)
+                return trap_hook(*this, in.op, trap_user);
+            return Status::Halted;
+        case TrapPolicy::Halt:
+        default:
+            return Status::Halted;
     }
-    else if (digit1 == 0xB) {
-        // BNNN JP V0, addr
-        pc = v_reg[0] + (op & 0x0FFF);
-        return;
+}
+
+void Emu::op_nop(const Instr& /*in*/) {
+    // 0000 NOP
+    pc += 2;
+}
+
+void Emu::op_cls(const Instr& /*in*/) {
+    // 00E0 CLS, only the selected planes
+    size_t words = display_height() * display_width() / 64;
+    for (size_t p = 0; p < num_planes(); ++p) {
+        if (plane_mask & (1 << p))
+            std::fill(plane_rows(p), plane_rows(p) + words, 0);
     }
-    else if (digit1 == 0xC) {
-        // CXNN RND Vx, byte
-        size_t x = digit2;
-        uint8_t nn = op & 0x00FF;
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint16_t> dist(0, 255);
-        uint8_t rng = dist(gen) & 0xFF;
-        v_reg[x] = rng & nn;
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_ret(const Instr& /*in*/) {
+    // 00EE RET
+    pc = pop();
+    pc += 2;
+}
+
+void Emu::op_jp(const Instr& in) {
+    // 1NNN JP addr
+    pc = in.nnn;
+}
+
+void Emu::op_call(const Instr& in) {
+    // 2NNN CALL addr
+    push(pc);
+    pc = in.nnn;
+}
+
+template <class Q>
+void Emu::op_se_vx_nn(const Instr& in) {
+    // 3XNN SE Vx, byte
+    size_t x = in.x;
+    uint8_t nn = in.nn;
+    if (v_reg[x] == nn)
+        pc += skip_size<Q>();
+    else
         pc += 2;
-        return;
-    }
-    else if (digit1 == 0xD) {
-        // DXYN DRW Vx, Vy, nibble
-        uint16_t x_cord = v_reg[digit2];
-        uint16_t y_cord = v_reg[digit3];
-        uint16_t height = digit4;
+}
+
+template <class Q>
+void Emu::op_sne_vx_nn(const Instr& in) {
+    // 4XNN SNE Vx, byte
+    size_t x = in.x;
+    uint8_t nn = in.nn;
+    if (v_reg[x] != nn)
+        pc += skip_size<Q>();
+    else
+        pc += 2;
+}
+
+template <class Q>
+void Emu::op_se_vx_vy(const Instr& in) {
+    // 5XY0 SE Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    if (v_reg[x] == v_reg[y])
+        pc += skip_size<Q>();
+    else
+        pc += 2;
+}
+
+void Emu::op_ld_vx_nn(const Instr& in) {
+    // 6XNN LD Vx, byte
+    size_t x = in.x;
+    v_reg[x] = in.nn;
+    pc += 2;
+}
 
+void Emu::op_add_vx_nn(const Instr& in) {
+    // 7XNN ADD Vx, byte
+    size_t x = in.x;
+    v_reg[x] = v_reg[x] + (in.nn);
+    pc += 2;
+}
+
+void Emu::op_ld_vx_vy(const Instr& in) {
+    // 8XY0 LD Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[x] = v_reg[y];
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_or(const Instr& in) {
+    // 8XY1 OR Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[x] |= v_reg[y];
+    if constexpr (Q::vf_reset)
         v_reg[0xF] = 0;
+    pc += 2;
+}
 
-        for (uint16_t row = 0; row < height; ++row) {
-            uint16_t address = i_reg + row;
-            uint8_t pixels = ram[address];
-            for (uint8_t col = 0; col < 8; ++col) {
-                if ((pixels & (0b10000000 >> col)) != 0) {
-                    size_t x = (x_cord + col) % SCREEN_WIDTH;
-                    size_t y = (y_cord + row) % SCREEN_HEIGHT;
-                    size_t pixel_id = x + SCREEN_WIDTH * y;
+template <class Q>
+void Emu::op_and(const Instr& in) {
+    // 8XY2 AND Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[x] &= v_reg[y];
+    if constexpr (Q::vf_reset)
+        v_reg[0xF] = 0;
+    pc += 2;
+}
 
-                    if (screen[pixel_id])
-                        v_reg[0xF] = 1;
+template <class Q>
+void Emu::op_xor(const Instr& in) {
+    // 8XY3 XOR Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[x] ^= v_reg[y];
+    if constexpr (Q::vf_reset)
+        v_reg[0xF] = 0;
+    pc += 2;
+}
 
-                    screen[pixel_id] ^= true;
-                }
-            }
-        }
+void Emu::op_add_vx_vy(const Instr& in) {
+    // 8XY4 ADD Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    uint16_t sum = v_reg[x] + v_reg[y];
+    v_reg[0xF] = (sum > 0xFF) ? 1 : 0;
+    v_reg[x] = sum & 0xFF;
+    pc += 2;
+}
+
+void Emu::op_sub(const Instr& in) {
+    // 8XY5 SUB Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[0xF] = (v_reg[x] >= v_reg[y]) ? 1 : 0;
+    v_reg[x] = v_reg[x] - v_reg[y];
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_shr(const Instr& in) {
+    // 8XY6 SHR Vx {, Vy}
+    size_t x = in.x;
+    size_t src = Q::shift_vy ? in.y : in.x;
+    v_reg[0xF] = v_reg[src] & 0x1;
+    v_reg[x] = v_reg[src] >> 1;
+    pc += 2;
+}
+
+void Emu::op_subn(const Instr& in) {
+    // 8XY7 SUBN Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    v_reg[0xF] = (v_reg[y] >= v_reg[x]) ? 1 : 0;
+    v_reg[x] = v_reg[y] - v_reg[x];
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_shl(const Instr& in) {
+    // 8XYE SHL Vx {, Vy}
+    size_t x = in.x;
+    size_t src = Q::shift_vy ? in.y : in.x;
+    v_reg[0xF] = (v_reg[src] >> 7) & 0x1;
+    v_reg[x] = v_reg[src] << 1;
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_sne_vx_vy(const Instr& in) {
+    // 9XY0 SNE Vx, Vy
+    size_t x = in.x;
+    size_t y = in.y;
+    if (v_reg[x] != v_reg[y])
+        pc += skip_size<Q>();
+    else
         pc += 2;
-        return;
+}
+
+void Emu::op_ld_i(const Instr& in) {
+    // ANNN LD I, addr
+    i_reg = in.nnn;
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_jp_v0(const Instr& in) {
+    // BNNN JP V0, addr (BXNN JP Vx, addr with jump_vx)
+    pc = v_reg[Q::jump_vx ? in.x : 0] + in.nnn;
+}
+
+void Emu::op_rnd(const Instr& in) {
+    // CXNN RND Vx, byte
+    size_t x = in.x;
+    uint8_t nn = in.nn;
+    v_reg[x] = rng.next_byte() & nn;
+    pc += 2;
+}
+
+template <class Q>
+uint8_t& Emu::mem(size_t addr) {
+    if constexpr (Q::xo_chip) {
+        addr &= XO_RAM_SIZE - 1;
+        if (addr >= RAM_SIZE)
+            return high_ram[addr - RAM_SIZE];
+        return ram[addr];
     }
-    else if (digit1 == 0xE) {
-        size_t x = digit2;
-        if (digit3 == 0x9 && digit4 == 0xE) {
-            // EX9E SKP Vx
-            if (keys[v_reg[x]])
-                pc += 4;
-            else
-                pc += 2;
-            return;
-        }
-        else if (digit3 == 0xA && digit4 == 0x1) {
-            // EXA1 SKNP Vx
-            if (!keys[v_reg[x]])
-                pc += 4;
-            else
-                pc += 2;
-            return;
-        }
-        else {
-            throw std::runtime_error("Unknown EX?? opcode");
-        }
+    return ram[addr & (RAM_SIZE - 1)];
+}
+
+template <class Q>
+uint16_t Emu::skip_size() {
+    if constexpr (Q::xo_chip) {
+        if (mem<Q>(pc + 2) == 0xF0 && mem<Q>(pc + 3) == 0x00)
+            return 6;
     }
-    else if (digit1 == 0xF) {
-        size_t x = digit2;
-        uint8_t last_two = (digit3 << 4) | digit4;
+    return 4;
+}
 
-        if (last_two == 0x07) {
-            // FX07 LD Vx, DT
-            v_reg[x] = dt;
-            pc += 2;
-            return;
+template <class Q>
+void Emu::op_drw(const Instr& in) {
+    // DXYN DRW Vx, Vy, nibble
+    v_reg[0xF] = 0;
+    uint64_t changed;
+    if constexpr (Q::xo_chip) {
+        // Each selected plane takes the next sprite's worth of bytes
+        size_t bytes = in.n == 0 ? 32 : in.n;
+        size_t addr = i_reg;
+        changed = 0;
+        for (size_t p = 0; p < NUM_PLANES; ++p) {
+            if (!(plane_mask & (1 << p)))
+                continue;
+            changed |= hires ? draw_hires<Q>(in, plane_rows(p), addr) : draw_lores<Q>(in, plane_rows(p), addr);
+            addr += bytes;
         }
-        else if (last_two == 0x0A) {
-            // FX0A LD Vx, K
-            bool key_pressed = false;
-            for (size_t i = 0; i < NUM_KEYS; ++i) {
-                if (keys[i]) {
-                    v_reg[x] = i;
-                    key_pressed = true;
-                    break;
-                }
-            }
-            if (!key_pressed)
-                return;  // wait, don't advance pc
-            pc += 2;
-            return;
-        }
-        else if (last_two == 0x15) {
-            // FX15 LD DT, Vx
-            dt = v_reg[x];
-            pc += 2;
-            return;
+    } else {
+        changed = hires ? draw_hires<Q>(in, hires_screen, i_reg) : draw_lores<Q>(in, screen, i_reg);
+    }
+    if (changed) {
+        dirty_rows |= changed;
+        display_gen++;
+    }
+    pc += 2;
+}
+
+template <class Q>
+uint64_t Emu::draw_lores(const Instr& in, uint64_t* rows, size_t addr) {
+    uint16_t x_cord = v_reg[in.x] % SCREEN_WIDTH;
+    uint16_t y_cord = v_reg[in.y];
+    // Clipping still wraps the starting position, only the sprite is cut off
+    if constexpr (Q::clip)
+        y_cord %= SCREEN_HEIGHT;
+    uint16_t height = in.n;
+    bool big = Q::lores_dxy0 && height == 0;
+    if (big)
+        height = 16;
+
+    uint64_t changed = 0;
+
+    for (uint16_t row = 0; row < height; ++row) {
+        if constexpr (Q::clip) {
+            if (y_cord + row >= SCREEN_HEIGHT)
+                break;
         }
-        else if (last_two == 0x18) {
-            // FX18 LD ST, Vx
-            st = v_reg[x];
-            pc += 2;
-            return;
+        uint64_t sprite;
+        if (big) {
+            size_t address = addr + 2 * row;
+            sprite = uint64_t((mem<Q>(address) << 8) | mem<Q>(address + 1)) << 48;
+        } else {
+            sprite = uint64_t(mem<Q>(addr + row)) << 56;
         }
-        else if (last_two == 0x1E) {
-            // FX1E ADD I, Vx
-            i_reg = i_reg + v_reg[x];
-            pc += 2;
-            return;
+        // Rotating instead of shifting wraps the sprite around the right edge
+        uint64_t pixels = Q::clip ? sprite >> x_cord : rotr64(sprite, x_cord);
+        size_t y = (y_cord + row) % SCREEN_HEIGHT;
+        uint64_t& line = rows[y];
+
+        if (line & pixels)
+            v_reg[0xF] = 1;
+
+        line ^= pixels;
+        changed |= uint64_t(pixels != 0) << y;
+    }
+    return changed;
+}
+
+template <class Q>
+uint64_t Emu::draw_hires(const Instr& in, uint64_t* rows, size_t addr) {
+    // DXYN, or DXY0 for a 16x16 sprite of two bytes per row
+    size_t x_cord = v_reg[in.x] % HIRES_WIDTH;
+    size_t y_cord = v_reg[in.y] % HIRES_HEIGHT;
+    bool big = in.n == 0;
+    size_t height = big ? 16 : in.n;
+    // The sprite lands in the row word holding x_cord and spills into the next one
+    size_t word = x_cord / 64;
+    unsigned shift = x_cord % 64;
+
+    uint64_t changed = 0;
+
+    for (size_t row = 0; row < height; ++row) {
+        size_t y = y_cord + row;
+        if (y >= HIRES_HEIGHT) {
+            if constexpr (Q::clip)
+                break;
+            y -= HIRES_HEIGHT;
         }
-        else if (last_two == 0x29) {
-            // FX29 LD F, Vx
-            i_reg = 5 * v_reg[x];
-            pc += 2;
-            return;
+        uint64_t sprite;
+        if (big) {
+            size_t address = addr + 2 * row;
+            sprite = uint64_t((mem<Q>(address) << 8) | mem<Q>(address + 1)) << 48;
+        } else {
+            sprite = uint64_t(mem<Q>(addr + row)) << 56;
         }
-        else if (last_two == 0x33) {
-            // FX33 LD B, Vx
-            uint8_t vx = v_reg[x];
-            ram[i_reg] = vx / 100;
-            ram[i_reg + 1] = (vx / 10) % 10;
-            ram[i_reg + 2] = vx % 10;
+        uint64_t pixels[HIRES_ROW_WORDS] = {};
+        pixels[word] = sprite >> shift;
+        uint64_t spill = shift ? sprite << (64 - shift) : 0;
+        if (word + 1 < HIRES_ROW_WORDS)
+            pixels[word + 1] = spill;
+        else if (!Q::clip)
+            pixels[0] = spill;
+
+        uint64_t* line = &rows[y * HIRES_ROW_WORDS];
+        if ((line[0] & pixels[0]) | (line[1] & pixels[1]))
+            v_reg[0xF] = 1;
+
+        line[0] ^= pixels[0];
+        line[1] ^= pixels[1];
+        changed |= uint64_t((pixels[0] | pixels[1]) != 0) << y;
+    }
+    return changed;
+}
+
+template <class Q>
+void Emu::op_skp(const Instr& in) {
+    // EX9E SKP Vx
+    size_t x = in.x;
+    if (keys[v_reg[x] & (NUM_KEYS - 1)])
+        pc += skip_size<Q>();
+    else
+        pc += 2;
+}
+
+template <class Q>
+void Emu::op_sknp(const Instr& in) {
+    // EXA1 SKNP Vx
+    size_t x = in.x;
+    if (!keys[v_reg[x] & (NUM_KEYS - 1)])
+        pc += skip_size<Q>();
+    else
+        pc += 2;
+}
+
+void Emu::op_ld_vx_dt(const Instr& in) {
+    // FX07 LD Vx, DT
+    size_t x = in.x;
+    v_reg[x] = dt;
+    pc += 2;
+}
+
+void Emu::op_ld_vx_k(const Instr& in) {
+    // FX0A LD Vx, K
+    size_t x = in.x;
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        if (keys[i]) {
+            v_reg[x] = i;
             pc += 2;
             return;
         }
-        else if (last_two == 0x55) {
-            // FX55 LD [I], Vx
-            for (size_t i = 0; i <= x; ++i) {
-                ram[i_reg + i] = v_reg[i];
+    }
+    // wait, don't advance pc
+}
+
+void Emu::op_ld_dt_vx(const Instr& in) {
+    // FX15 LD DT, Vx
+    size_t x = in.x;
+    dt = v_reg[x];
+    pc += 2;
+}
+
+void Emu::op_ld_st_vx(const Instr& in) {
+    // FX18 LD ST, Vx
+    size_t x = in.x;
+    st = v_reg[x];
+    pc += 2;
+}
+
+void Emu::op_add_i_vx(const Instr& in) {
+    // FX1E ADD I, Vx
+    size_t x = in.x;
+    i_reg = i_reg + v_reg[x];
+    pc += 2;
+}
+
+void Emu::op_ld_f_vx(const Instr& in) {
+    // FX29 LD F, Vx
+    size_t x = in.x;
+    i_reg = 5 * v_reg[x];
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_ld_b_vx(const Instr& in) {
+    // FX33 LD B, Vx
+    uint8_t vx = v_reg[in.x];
+    mem<Q>(i_reg) = vx / 100;
+    mem<Q>(i_reg + 1) = (vx / 10) % 10;
+    mem<Q>(i_reg + 2) = vx % 10;
+    invalidate(i_reg, 3);
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_ld_i_vx(const Instr& in) {
+    // FX55 LD [I], Vx
+    size_t x = in.x;
+    for (size_t i = 0; i <= x; ++i) {
+        mem<Q>(i_reg + i) = v_reg[i];
+    }
+    invalidate(i_reg, x + 1);
+    if constexpr (Q::increment_i)
+        i_reg += x + 1;
+    pc += 2;
+}
+
+template <class Q>
+void Emu::op_ld_vx_i(const Instr& in) {
+    // FX65 LD Vx, [I]
+    size_t x = in.x;
+    for (size_t i = 0; i <= x; ++i) {
+        v_reg[i] = mem<Q>(i_reg + i);
+    }
+    if constexpr (Q::increment_i)
+        i_reg += x + 1;
+    pc += 2;
+}
+
+
+void Emu::op_scd(const Instr& in) {
+    // 00CN SCD nibble: whole rows move down, N pixels of the current resolution
+    size_t words = hires ? HIRES_ROW_WORDS : 1;
+    size_t total = display_height() * words;
+    size_t by = std::min<size_t>(in.n * words, total);
+    for (size_t p = 0; p < num_planes(); ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        uint64_t* rows = plane_rows(p);
+        std::memmove(rows + by, rows, (total - by) * sizeof(uint64_t));
+        std::fill(rows, rows + by, 0);
+    }
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_scu(const Instr& in) {
+    // 00DN SCU nibble (XO-CHIP)
+    size_t words = hires ? HIRES_ROW_WORDS : 1;
+    size_t total = display_height() * words;
+    size_t by = std::min<size_t>(in.n * words, total);
+    for (size_t p = 0; p < num_planes(); ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        uint64_t* rows = plane_rows(p);
+        std::memmove(rows, rows + by, (total - by) * sizeof(uint64_t));
+        std::fill(rows + total - by, rows + total, 0);
+    }
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_scr(const Instr& /*in*/) {
+    // 00FB SCR: 4 pixels right
+    for (size_t p = 0; p < num_planes(); ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        uint64_t* rows = plane_rows(p);
+        if (hires) {
+            for (size_t y = 0; y < HIRES_HEIGHT; ++y) {
+                uint64_t* line = &rows[y * HIRES_ROW_WORDS];
+                line[1] = (line[1] >> 4) | (line[0] << 60);
+                line[0] >>= 4;
             }
-            pc += 2;
-            return;
-        }
-        else if (last_two == 0x65) {
-            // FX65 LD Vx, [I]
-            for (size_t i = 0; i <= x; ++i) {
-                v_reg[i] = ram[i_reg + i];
+        } else {
+            for (size_t y = 0; y < SCREEN_HEIGHT; ++y) {
+                rows[y] >>= 4;
             }
-            pc += 2;
-            return;
         }
-        else {
-            throw std::runtime_error("Unknown FX?? opcode");
+    }
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_scl(const Instr& /*in*/) {
+    // 00FC SCL: 4 pixels left
+    for (size_t p = 0; p < num_planes(); ++p) {
+        if (!(plane_mask & (1 << p)))
+            continue;
+        uint64_t* rows = plane_rows(p);
+        if (hires) {
+            for (size_t y = 0; y < HIRES_HEIGHT; ++y) {
+                uint64_t* line = &rows[y * HIRES_ROW_WORDS];
+                line[0] = (line[0] << 4) | (line[1] >> 60);
+                line[1] <<= 4;
+            }
+        } else {
+            for (size_t y = 0; y < SCREEN_HEIGHT; ++y) {
+                rows[y] <<= 4;
+            }
         }
     }
-    else {
-        char buffer[50];
-        snprintf(buffer, sizeof(buffer), "Unimplemented opcode: 0x%04X", op);
-        throw std::runtime_error(buffer);
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_exit(const Instr& /*in*/) {
+    // 00FD EXIT: stays here, run() and wait_state() see a halted machine
+}
+
+void Emu::op_low(const Instr& /*in*/) {
+    // 00FE LOW
+    hires = false;
+    clear_planes();
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_high(const Instr& /*in*/) {
+    // 00FF HIGH
+    hires = true;
+    clear_planes();
+    mark_display_dirty();
+    pc += 2;
+}
+
+void Emu::op_ld_hf_vx(const Instr& in) {
+    // FX30 LD HF, Vx
+    i_reg = BIG_FONT_ADDR + 10 * (v_reg[in.x] & 0xF);
+    pc += 2;
+}
+
+void Emu::op_ld_r_vx(const Instr& in) {
+    // FX75 LD R, Vx
+    std::copy(v_reg, v_reg + in.x + 1, rpl);
+    pc += 2;
+}
+
+void Emu::op_ld_vx_r(const Instr& in) {
+    // FX85 LD Vx, R
+    std::copy(rpl, rpl + in.x + 1, v_reg);
+    pc += 2;
+}
+
+void Emu::op_ld_i_long(const Instr& /*in*/) {
+    // F000 NNNN LD I, long: the address is the next word
+    i_reg = (mem<QuirksXoChip>(pc + 2) << 8) | mem<QuirksXoChip>(pc + 3);
+    pc += 4;
+}
+
+void Emu::op_save_range(const Instr& in) {
+    // 5XY2 SAVE Vx - Vy, in either direction, I unchanged
+    size_t count = (in.x < in.y ? in.y - in.x : in.x - in.y) + 1;
+    int step = in.x < in.y ? 1 : -1;
+    for (size_t i = 0; i < count; ++i) {
+        mem<QuirksXoChip>(i_reg + i) = v_reg[in.x + step * int(i)];
+    }
+    invalidate(i_reg, count);
+    pc += 2;
+}
+
+void Emu::op_load_range(const Instr& in) {
+    // 5XY3 LOAD Vx - Vy, in either direction, I unchanged
+    size_t count = (in.x < in.y ? in.y - in.x : in.x - in.y) + 1;
+    int step = in.x < in.y ? 1 : -1;
+    for (size_t i = 0; i < count; ++i) {
+        v_reg[in.x + step * int(i)] = mem<QuirksXoChip>(i_reg + i);
+    }
+    pc += 2;
+}
+
+void Emu::op_plane(const Instr& in) {
+    // FN01 PLANE n: bitmask of the planes CLS, DRW and the scrolls touch
+    plane_mask = in.x;
+    pc += 2;
+}
+
+void Emu::op_audio(const Instr& /*in*/) {
+    // F002 AUDIO: 16 bytes at I become the 1-bit sample pattern
+    for (size_t i = 0; i < AUDIO_PATTERN_SIZE; ++i) {
+        audio_pattern[i] = mem<QuirksXoChip>(i_reg + i);
     }
+    pc += 2;
 }
 
+void Emu::op_pitch(const Instr& in) {
+    // FX3A PITCH Vx
+    pitch = v_reg[in.x];
+    pc += 2;
+}
 
 uint16_t Emu::fetch() {
-    uint16_t op = (ram[pc] << 8) | ram[pc + 1];
-    return op;
+    if (size_t(pc) + 1 < RAM_SIZE)
+        return (ram[pc] << 8) | ram[pc + 1];
+    return (peek(pc) << 8) | peek(size_t(pc) + 1);
 }
 
 void Emu::tick_timers() {
@@ -380,3 +1343,77 @@ void Emu::tick_timers() {
         st--;
     }
 }
+
+static uint16_t read_op(const uint8_t* ram, size_t addr) {
+    return (ram[addr] << 8) | ram[addr + 1];
+}
+
+// Finds an FX07 / 3XNN / 1NNN loop containing pc and returns the address of
+// its FX07, or RAM_SIZE if pc is not in one
+static size_t timer_loop_head(const Emu& emu) {
+    for (size_t back = 0; back <= 4 && back <= emu.pc; back += 2) {
+        size_t head = emu.pc - back;
+        if (head + 6 > RAM_SIZE)
+            continue;
+        uint16_t get = read_op(emu.ram, head);
+        uint16_t skip = read_op(emu.ram, head + 2);
+        uint16_t jump = read_op(emu.ram, head + 4);
+        if ((get & 0xF0FF) == 0xF007 && (skip & 0xF000) == 0x3000
+            && (skip & 0x0F00) == (get & 0x0F00) && jump == (0x1000 | head))
+            return head;
+    }
+    return RAM_SIZE;
+}
+
+WaitState Emu::wait_state() const {
+    if (size_t(pc) + 1 >= RAM_SIZE)
+        return WaitState::Running;
+
+    uint16_t op = read_op(ram, pc);
+    if (op == (0x1000 | pc) || op == 0x00FD)
+        return WaitState::Halted;
+    if ((op & 0xF0FF) == 0xF00A && std::none_of(keys, keys + NUM_KEYS, [](bool held) { return held; }))
+        return WaitState::Key;
+
+    size_t head = timer_loop_head(*this);
+    if (head != RAM_SIZE) {
+        uint8_t x = ram[head] & 0xF;
+        uint8_t nn = ram[head + 3];
+        // About to exit if DT already matches, or if the 3XNN at pc is
+        // comparing a value read while it did
+        bool exiting = dt == nn || (pc == head + 2 && v_reg[x] == nn);
+        if (!exiting)
+            return WaitState::DelayTimer;
+    }
+    return WaitState::Running;
+}
+
+// Each skipped frame has to run the loop's FX07 at least once
+static_assert(TICKS_PER_FRAME >= 3, "fast_forward assumes a full timer loop per frame");
+
+size_t Emu::fast_forward(size_t max_frames) {
+    WaitState state = wait_state();
+    if (state == WaitState::Running || max_frames == 0)
+        return 0;
+
+    size_t frames = max_frames;
+    if (state == WaitState::DelayTimer) {
+        size_t head = timer_loop_head(*this);
+        uint8_t x = ram[head] & 0xF;
+        uint8_t nn = ram[head + 3];
+        // DT only counts down, so a target above it is never reached
+        if (dt > nn)
+            frames = std::min(frames, size_t(dt - nn));
+
+        // Where the loop is after frames * TICKS_PER_FRAME ticks, and the DT
+        // its last FX07 saw during the final frame
+        size_t pos = (pc - head) / 2;
+        pos = (pos + (frames % 3) * (TICKS_PER_FRAME % 3)) % 3;
+        pc = head + 2 * pos;
+        v_reg[x] = dt > frames - 1 ? dt - (frames - 1) : 0;
+    }
+
+    dt = dt > frames ? dt - frames : 0;
+    st = st > frames ? st - frames : 0;
+    return frames;
+}
@@ -2,6 +2,9 @@
 
 #include <cstdint>
 #include <cstddef>  // for size_t
+#include <vector>
+
+#include "rng.h"
 
 // Function declarations
 uint64_t add(uint64_t left, uint64_t right);
@@ -10,6 +13,11 @@ uint64_t add(uint64_t left, uint64_t right);
 constexpr size_t FONTSET_SIZE = 80;
 extern const uint8_t FONTSET[FONTSET_SIZE];
 
+// SUPER-CHIP 8x10 digits for FX30, stored right after FONTSET
+constexpr size_t BIG_FONTSET_SIZE = 160;
+constexpr uint16_t BIG_FONT_ADDR = FONTSET_SIZE;
+extern const uint8_t BIG_FONTSET[BIG_FONTSET_SIZE];
+
 constexpr size_t SCREEN_WIDTH = 64;
 constexpr size_t SCREEN_HEIGHT = 32;
 constexpr size_t RAM_SIZE = 4096;
@@ -17,15 +25,243 @@ constexpr size_t NUM_REGS = 16;
 constexpr size_t STACK_SIZE = 16;
 constexpr size_t NUM_KEYS = 16;
 
+// Instructions per 60 Hz frame
+constexpr size_t TICKS_PER_FRAME = 10;
+
 constexpr uint16_t START_ADDR = 0x200;
 
+// RAM is tracked in pages so snapshots only copy what changed
+constexpr size_t RAM_PAGE_SIZE = 256;
+constexpr size_t NUM_RAM_PAGES = RAM_SIZE / RAM_PAGE_SIZE;
+
+// The display is one uint64_t per row, bit 63 is the leftmost pixel
+static_assert(SCREEN_WIDTH == 64, "a display row must fill one uint64_t");
+
+// SUPER-CHIP high resolution, two uint64_t per row with the left half first
+constexpr size_t HIRES_WIDTH = 128;
+constexpr size_t HIRES_HEIGHT = 64;
+constexpr size_t HIRES_ROW_WORDS = HIRES_WIDTH / 64;
+static_assert(HIRES_HEIGHT <= 64, "dirty_rows needs a bit per row");
+static_assert(NUM_RAM_PAGES <= 16, "dirty_pages needs a bit per page");
+
+// XO-CHIP: I reaches 64 KB and there are up to four bit planes, selected by FN01
+constexpr size_t XO_RAM_SIZE = 0x10000;
+constexpr size_t NUM_PLANES = 4;
+// Words per plane, enough for either resolution
+constexpr size_t PLANE_WORDS = HIRES_HEIGHT * HIRES_ROW_WORDS;
+// F002 loads this many bytes of 1-bit audio samples
+constexpr size_t AUDIO_PATTERN_SIZE = 16;
+// FX3A pitch that plays the pattern at 4000 samples per second
+constexpr uint8_t DEFAULT_PITCH = 64;
+
+// Set CHIP8_TABLE_DISPATCH=0 to decode through the if/else chain instead of the 64K table
+#ifndef CHIP8_TABLE_DISPATCH
+#define CHIP8_TABLE_DISPATCH 1
+#endif
+
+// Every 16-bit word decodes to exactly one of these
+enum class Opcode : uint8_t {
+    Undecoded,  // empty decode cache slot
+    Nop,        // 0000
+    Cls,        // 00E0
+    Ret,        // 00EE
+    Jp,         // 1NNN
+    Call,       // 2NNN
+    SeVxNN,     // 3XNN
+    SneVxNN,    // 4XNN
+    SeVxVy,     // 5XY0
+    LdVxNN,     // 6XNN
+    AddVxNN,    // 7XNN
+    LdVxVy,     // 8XY0
+    Or,         // 8XY1
+    And,        // 8XY2
+    Xor,        // 8XY3
+    AddVxVy,    // 8XY4
+    Sub,        // 8XY5
+    Shr,        // 8XY6
+    Subn,       // 8XY7
+    Shl,        // 8XYE
+    SneVxVy,    // 9XY0
+    LdI,        // ANNN
+    JpV0,       // BNNN
+    Rnd,        // CXNN
+    Drw,        // DXYN
+    Skp,        // EX9E
+    Sknp,       // EXA1
+    LdVxDt,     // FX07
+    LdVxK,      // FX0A
+    LdDtVx,     // FX15
+    LdStVx,     // FX18
+    AddIVx,     // FX1E
+    LdFVx,      // FX29
+    LdBVx,      // FX33
+    LdIVx,      // FX55
+    LdVxI,      // FX65
+    Scd,        // 00CN  SUPER-CHIP from here on
+    Scr,        // 00FB
+    Scl,        // 00FC
+    Exit,       // 00FD
+    Low,        // 00FE
+    High,       // 00FF
+    LdHfVx,     // FX30
+    LdRVx,      // FX75
+    LdVxR,      // FX85
+    LdILong,    // F000 NNNN  XO-CHIP from here on, trapped by other profiles
+    SaveRange,  // 5XY2
+    LoadRange,  // 5XY3
+    Plane,      // FN01
+    Audio,      // F002
+    Pitch,      // FX3A
+    Scu,        // 00DN
+    Unknown,    // must stay last, see Emu::trap_from
+    Count
+};
+
+Opcode decode(uint16_t op);
+
+// An opcode with its operand fields already pulled out
+struct Instr {
+    Opcode opcode;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+    uint16_t nnn;
+    uint16_t op;
+};
+
+Instr decode_instr(uint16_t op);
+
+// What the instruction at pc is spinning on, see Emu::wait_state()
+enum class WaitState : uint8_t {
+    Running,     // making progress
+    DelayTimer,  // FX07 / 3XNN / 1NNN loop until DT reaches NN
+    Key,         // FX0A with no key held
+    Halted,      // 1NNN jumping to itself, or 00FD
+};
+
+// Behaviours that differ between CHIP-8 interpreters. Each profile is a set
+// of constexpr flags; the handlers that depend on them are instantiated once
+// per profile so none of them test a flag at run time.
+struct QuirksDefault {
+    static constexpr bool shift_vy = false;     // 8XY6/8XYE shift Vy into Vx instead of Vx in place
+    static constexpr bool increment_i = false;  // FX55/FX65 leave I at I + X + 1
+    static constexpr bool jump_vx = false;      // BXNN jumps to XNN + Vx instead of NNN + V0
+    static constexpr bool clip = false;         // DXYN clips at the screen edges instead of wrapping
+    static constexpr bool vf_reset = false;     // 8XY1/8XY2/8XY3 clear VF
+    static constexpr bool lores_dxy0 = false;   // DXY0 draws 16x16 in low resolution too, not nothing
+    static constexpr bool xo_chip = false;      // XO-CHIP opcodes, 64 KB memory through I and bit planes
+};
+
+struct QuirksCosmacVip {
+    static constexpr bool shift_vy = true;
+    static constexpr bool increment_i = true;
+    static constexpr bool jump_vx = false;
+    static constexpr bool clip = true;
+    static constexpr bool vf_reset = true;
+    static constexpr bool lores_dxy0 = false;
+    static constexpr bool xo_chip = false;
+};
+
+struct QuirksSuperChip {
+    static constexpr bool shift_vy = false;
+    static constexpr bool increment_i = false;
+    static constexpr bool jump_vx = true;
+    static constexpr bool clip = true;
+    static constexpr bool vf_reset = false;
+    static constexpr bool lores_dxy0 = true;
+    static constexpr bool xo_chip = false;
+};
+
+struct QuirksXoChip {
+    static constexpr bool shift_vy = true;
+    static constexpr bool increment_i = true;
+    static constexpr bool jump_vx = false;
+    static constexpr bool clip = false;
+    static constexpr bool vf_reset = false;
+    static constexpr bool lores_dxy0 = true;
+    static constexpr bool xo_chip = true;
+};
+
+// Runtime name for one of the structs above, see Emu::set_quirks()
+enum class QuirkProfile : uint8_t {
+    Default,  // what this emulator has always done
+    CosmacVip,
+    SuperChip,
+    XoChip,
+    Count
+};
+
+// Accepts "default", "vip", "schip" and "xochip"
+bool parse_quirk_profile(const char* name, QuirkProfile& out);
+
+const char* quirk_profile_name(QuirkProfile profile);
+
+// Profile a ROM file runs under by its extension: XoChip for .xo8,
+// SuperChip for .sc8, Default for anything else
+QuirkProfile profile_for(const char* path);
+
+// Result of tick()
+enum class Status : uint8_t {
+    Ok,
+    Trapped,  // hit a trap (see TrapPolicy) and carried on past it
+    Halted,   // stopped on a trap, pc still points at it
+};
+
+// What tick() does with an opcode that decodes to Opcode::Unknown, one the
+// profile does not implement, or a 2NNN / 00EE that would overflow or
+// underflow the stack
+enum class TrapPolicy : uint8_t {
+    Halt,  // leave pc on it and return Status::Halted, every tick until pc moves
+    Skip,  // step over it and return Status::Trapped
+    Nop,   // step over it and return Status::Ok
+    Hook,  // call trap_hook and return what it returns
+};
+
+// Why run() returned
+enum class StopReason : uint8_t {
+    Budget,  // executed max_instructions
+    Draw,    // 00E0 or DXYN changed the display
+    Wait,    // a 1NNN to itself, FX0A with no key held, or 00FD
+    Trap,    // tick() would have returned something other than Status::Ok
+};
+
+struct RunResult {
+    uint32_t cycles;  // instructions executed
+    StopReason stop;
+    Status status;    // of the last instruction; for run_frame() see there
+    uint32_t traps;   // unknown opcodes stepped over with TrapPolicy::Skip
+};
+
+struct Emu;
+
+// Runs with pc still at the trapping instruction. May change any state,
+// e.g. advance pc or implement the opcode itself.
+using TrapHook = Status (*)(Emu& emu, uint16_t op, void* user);
+
+class Tracer;
+
 // Emulator struct declaration
 struct Emu {
 
 public:
     uint16_t pc;
     uint8_t ram[RAM_SIZE];
-    bool screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+    uint64_t screen[SCREEN_HEIGHT];
+    // Set by 00FF. While set hires_screen is the display and screen is unused.
+    bool hires;
+    uint64_t hires_screen[HIRES_HEIGHT * HIRES_ROW_WORDS];
+    // FX75/FX85 user flags
+    uint8_t rpl[NUM_REGS];
+    // XO-CHIP only, and empty otherwise so other instances stay small: RAM
+    // from RAM_SIZE up to XO_RAM_SIZE, and planes 1 and up, PLANE_WORDS each
+    std::vector<uint8_t> high_ram;
+    std::vector<uint64_t> extra_planes;
+    // FN01 selection, bit n for plane n. Plane 0 is screen or hires_screen.
+    uint8_t plane_mask;
+    // F002 samples, one bit each, and the FX3A pitch they play at
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
     uint8_t v_reg[NUM_REGS];
     uint16_t i_reg;
     uint16_t sp;
@@ -33,26 +269,226 @@ public:
     bool keys[NUM_KEYS];
     uint8_t dt;
     uint8_t st;
+    // Decoded instruction per RAM address, filled lazily by tick()
+    Instr icache[RAM_SIZE];
+    // Bit n set when page n was written since the last snapshot, see state.h
+    uint16_t dirty_pages;
+    // Likewise for all of high_ram, which is tracked as a single page
+    bool high_ram_dirty;
+    // Receives every executed instruction when built with CHIP8_TRACE=1
+    Tracer* tracer;
+    // Bumped whenever 00E0 or DXYN changes the display
+    uint32_t display_gen;
+    // Bit n set when row n changed since the last take_dirty_rows()
+    uint64_t dirty_rows;
+    // Source for CXNN, seeded from std::random_device unless seed() is called
+    Rng rng;
+    // What rng was last seeded with; reset() seeds it again, so a seeded
+    // instance replays the same CXNN sequence after every reset
+    uint64_t rng_seed;
+    // Set through set_quirks(), kept across reset() like tracer
+    QuirkProfile quirks;
+    // Opcodes from this one up (see the enum) trap; follows quirks
+    Opcode trap_from;
+    // Unknown opcode handling, kept across reset() like tracer
+    TrapPolicy trap_policy;
+    TrapHook trap_hook;
+    void* trap_user;
 
     Emu();
+    // Emu() followed by seed(seed_value)
+    explicit Emu(uint64_t seed_value);
 
     void reset();
 
+    // Makes CXNN deterministic for this instance
+    void seed(uint64_t value);
+
+    // sp is masked into the stack; 2NNN and 00EE trap before they would
+    // go past either end, see stack_fault()
     void push(uint16_t val);
 
     uint16_t pop();
 
-    void tick();
+    Status tick();
+
+    // Ticks until max_instructions have run or one of the StopReason events
+    // happens, whichever is first. The instruction that caused the stop is
+    // counted in cycles.
+    RunResult run(uint32_t max_instructions);
+
+    // One 60 Hz frame: TICKS_PER_FRAME ticks, then tick_timers(). Leaves the
+    // machine exactly as that would, except that once a Wait is hit the
+    // remaining ticks of the frame would all repeat the same instruction and
+    // are not executed (nor traced). Only stops early on Status::Halted, in
+    // which case the timers are still ticked. cycles counts what actually
+    // ran; status is Halted, else Trapped if any trap happened, else Ok.
+    RunResult run_frame();
+
+    // Switches to the handlers instantiated for profile. The JIT and
+    // EmuBatch only implement QuirkProfile::Default. XoChip allocates
+    // high_ram and extra_planes, any other profile frees them.
+    void set_quirks(QuirkProfile profile);
+
+    // RAM_SIZE, or XO_RAM_SIZE under the XO-CHIP profile
+    size_t memory_size() const;
+
+    // Reads any address below memory_size(), 0 above it
+    uint8_t peek(size_t addr) const;
+
+    // trap_hook is only called with TrapPolicy::Hook; user is passed back to it
+    void set_trap_policy(TrapPolicy policy, TrapHook hook = nullptr, void* user = nullptr);
+
+    // Zero-copy view of the packed rows of the current resolution. Each row
+    // is display_width() / 64 words; in low resolution that is screen.
+    const uint64_t* get_display() const;
+
+    size_t display_width() const;
+
+    size_t display_height() const;
+
+    // Expands the display into SCREEN_WIDTH * SCREEN_HEIGHT bools. In high
+    // resolution each bool covers 2x2 pixels and is set if any of them is.
+    void unpack_display(bool* out) const;
 
-    const bool* get_display() const;
+    // In the current resolution
+    bool get_pixel(size_t x, size_t y) const;
+
+    // 1, or NUM_PLANES under the XO-CHIP profile
+    size_t num_planes() const;
+
+    // Rows of one plane laid out like get_display(); plane 0 is get_display()
+    const uint64_t* get_plane(size_t plane) const;
+
+    // Bit n set when the pixel is lit on plane n
+    uint8_t get_color(size_t x, size_t y) const;
+
+    // Returns the rows changed since the previous call and clears them. Bit
+    // n is row n of the current resolution; a resolution switch marks all.
+    // Meant for a single consumer; others should compare display_gen.
+    uint64_t take_dirty_rows();
+
+    // For code that replaces screen wholesale, e.g. loading a save state
+    void mark_display_dirty();
 
     void keypress(size_t key, bool pressed);
 
     void load(const uint8_t* data, size_t length);
 
-    void execute(uint16_t op);
+    // Must be called after writing to ram directly so stale decodes are
+    // dropped and the pages are picked up by the next snapshot
+    void invalidate(size_t addr, size_t length);
+
+    Status execute(uint16_t op);
+    // Runs a decoded instruction through the handlers run() inlines rather
+    // than tick()'s table, untraced; pc must already point at it. For the JIT.
+    Status execute(const Instr& in);
 
     uint16_t fetch();
 
     void tick_timers();
+
+    // Recognizes the common wait loops at pc. Only looks at RAM and
+    // registers, so it is cheap enough to call every frame.
+    WaitState wait_state() const;
+
+    // Call between frames. While the ROM is in a wait loop, runs up to
+    // max_frames frames (TICKS_PER_FRAME ticks plus tick_timers each) without
+    // executing them and returns how many it covered; 0 means tick normally.
+    // The machine ends up exactly as if the frames had been ticked, except
+    // that the skipped instructions are not traced.
+    size_t fast_forward(size_t max_frames);
+
+private:
+    Status dispatch(const Instr& instr);
+
+    // Kept out of line so the common path through dispatch() stays small
+    Status trap(const Instr& in);
+    // A 2NNN with the stack full or a 00EE with it empty
+    bool stack_fault(const Instr& in) const;
+
+    // Body of run() and run_frame(), one per profile so the handlers can be
+    // inlined. With whole_frame set, draws and Status::Trapped do not stop
+    // the loop, only Wait and Status::Halted do.
+    template <class Q, bool whole_frame>
+    RunResult run_loop(uint32_t max_instructions);
+    // Picks the run_loop() for quirks
+    template <bool whole_frame>
+    RunResult run_profile(uint32_t max_instructions);
+    // Runs one instruction through a switch instead of HANDLERS<Q>
+    template <class Q>
+    Status exec(const Instr& in);
+
+    using Handler = void (Emu::*)(const Instr& in);
+    // One table per quirk profile
+    template <class Q>
+    static const Handler HANDLERS[static_cast<size_t>(Opcode::Count)];
+    // HANDLERS<Q> indexed by QuirkProfile
+    static const Handler* const HANDLER_TABLES[static_cast<size_t>(QuirkProfile::Count)];
+
+    void op_nop(const Instr& in);
+    void op_cls(const Instr& in);
+    void op_ret(const Instr& in);
+    void op_jp(const Instr& in);
+    void op_call(const Instr& in);
+    template <class Q> void op_se_vx_nn(const Instr& in);
+    template <class Q> void op_sne_vx_nn(const Instr& in);
+    template <class Q> void op_se_vx_vy(const Instr& in);
+    void op_ld_vx_nn(const Instr& in);
+    void op_add_vx_nn(const Instr& in);
+    void op_ld_vx_vy(const Instr& in);
+    template <class Q> void op_or(const Instr& in);
+    template <class Q> void op_and(const Instr& in);
+    template <class Q> void op_xor(const Instr& in);
+    void op_add_vx_vy(const Instr& in);
+    void op_sub(const Instr& in);
+    template <class Q> void op_shr(const Instr& in);
+    void op_subn(const Instr& in);
+    template <class Q> void op_shl(const Instr& in);
+    template <class Q> void op_sne_vx_vy(const Instr& in);
+    void op_ld_i(const Instr& in);
+    template <class Q> void op_jp_v0(const Instr& in);
+    void op_rnd(const Instr& in);
+    template <class Q> void op_drw(const Instr& in);
+    // Draw one plane's sprite from addr into rows, returning the changed rows
+    template <class Q> uint64_t draw_lores(const Instr& in, uint64_t* rows, size_t addr);
+    template <class Q> uint64_t draw_hires(const Instr& in, uint64_t* rows, size_t addr);
+
+    uint64_t* plane_rows(size_t plane);
+    // Blanks every plane of both resolutions
+    void clear_planes();
+
+    // Memory as addressed through I, wrapping at memory_size() so that XO-CHIP
+    // reaches past RAM_SIZE and nothing else does
+    template <class Q> uint8_t& mem(size_t addr);
+
+    // Bytes a taken skip moves pc by: 4, or 6 over XO-CHIP's F000 NNNN
+    template <class Q> uint16_t skip_size();
+    template <class Q> void op_skp(const Instr& in);
+    template <class Q> void op_sknp(const Instr& in);
+    void op_ld_vx_dt(const Instr& in);
+    void op_ld_vx_k(const Instr& in);
+    void op_ld_dt_vx(const Instr& in);
+    void op_ld_st_vx(const Instr& in);
+    void op_add_i_vx(const Instr& in);
+    void op_ld_f_vx(const Instr& in);
+    template <class Q> void op_ld_b_vx(const Instr& in);
+    template <class Q> void op_ld_i_vx(const Instr& in);
+    template <class Q> void op_ld_vx_i(const Instr& in);
+    void op_scd(const Instr& in);
+    void op_scr(const Instr& in);
+    void op_scl(const Instr& in);
+    void op_exit(const Instr& in);
+    void op_low(const Instr& in);
+    void op_high(const Instr& in);
+    void op_ld_hf_vx(const Instr& in);
+    void op_ld_r_vx(const Instr& in);
+    void op_ld_vx_r(const Instr& in);
+    void op_ld_i_long(const Instr& in);
+    void op_save_range(const Instr& in);
+    void op_load_range(const Instr& in);
+    void op_plane(const Instr& in);
+    void op_audio(const Instr& in);
+    void op_pitch(const Instr& in);
+    void op_scu(const Instr& in);
 };
@@ -0,0 +1,855 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#if CHIP8_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Byte offsets of the fields generated code touches, addressed as [rdi + disp32]
+const int32_t OFF_V = offsetof(Emu, v_reg);
+const int32_t OFF_I = offsetof(Emu, i_reg);
+const int32_t OFF_DT = offsetof(Emu, dt);
+const int32_t OFF_ST = offsetof(Emu, st);
+const int32_t OFF_PC = offsetof(Emu, pc);
+const int32_t OFF_SP = offsetof(Emu, sp);
+const int32_t OFF_STACK = offsetof(Emu, stack);
+const int32_t OFF_KEYS = offsetof(Emu, keys);
+const int32_t OFF_RAM = offsetof(Emu, ram);
+const int32_t OFF_ICACHE = offsetof(Emu, icache);
+const int32_t OFF_PAGES = offsetof(Emu, dirty_pages);
+const int32_t OFF_SCREEN = offsetof(Emu, screen);
+const int32_t OFF_HIRES = offsetof(Emu, hires);
+const int32_t OFF_GEN = offsetof(Emu, display_gen);
+const int32_t OFF_DIRTY = offsetof(Emu, dirty_rows);
+
+// x86 register numbers used in ModRM.reg
+constexpr uint8_t AL = 0;
+constexpr uint8_t CL = 1;
+constexpr uint8_t DL = 2;
+
+// What a block returns, see Jit::BlockFn
+constexpr uint32_t exit_value(uint16_t pc, Status status = Status::Ok) {
+    return pc | uint32_t(status) << 24;
+}
+
+// Set next to the Status a helper returns to make the block exit even though
+// the instruction fell through
+constexpr uint32_t LEAVE_BLOCK = 0x100;
+
+// The helpers blocks call for what they do not compile. The instruction's
+// pc is already in emu->pc.
+uint32_t run_tick(Emu* emu) {
+    // Traps may do anything, so the block always exits after one
+    return uint32_t(emu->tick()) | LEAVE_BLOCK;
+}
+
+uint32_t run_instr(Emu* emu, const Instr* in) {
+    return uint32_t(emu->execute(*in));
+}
+
+// Whether a write of length bytes at addr hits span: the first byte the
+// block was compiled from and, in the upper half, the last
+bool writes_into(uint32_t span, uint16_t addr, size_t length) {
+    size_t low = span & 0xFFFF;
+    size_t high = span >> 16;
+    size_t first = addr & (RAM_SIZE - 1);
+    size_t end = first + length;
+    // A write running off the end of RAM carries on at 0
+    if (end > RAM_SIZE && low < end - RAM_SIZE)
+        return true;
+    return first <= high && end > low;
+}
+
+// FX33 and FX55, which also exit the block when they write into it
+uint32_t run_store(Emu* emu, const Instr* in, uint32_t span) {
+    uint16_t i_reg = emu->i_reg;
+    uint32_t result = uint32_t(emu->execute(*in));
+    size_t length = in->opcode == Opcode::LdBVx ? 3 : in->x + 1;
+    return writes_into(span, i_reg, length) ? result | LEAVE_BLOCK : result;
+}
+
+// FX33's digits for every byte, padded to 4
+struct BcdTable {
+    uint8_t digits[256][4];
+
+    constexpr BcdTable() : digits() {
+        for (size_t value = 0; value < 256; ++value) {
+            digits[value][0] = uint8_t(value / 100);
+            digits[value][1] = uint8_t(value / 10 % 10);
+            digits[value][2] = uint8_t(value % 10);
+        }
+    }
+};
+
+constexpr BcdTable BCD;
+
+struct Emitter {
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) {
+        code.push_back(b);
+    }
+
+    void imm16(uint16_t v) {
+        byte(v & 0xFF);
+        byte(v >> 8);
+    }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            byte((v >> (8 * i)) & 0xFF);
+        }
+    }
+
+    void imm64(uint64_t v) {
+        for (int i = 0; i < 8; ++i) {
+            byte((v >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // <opcode> [rdi + disp32] with reg in ModRM.reg
+    void mem(uint8_t opcode, uint8_t reg, int32_t disp) {
+        byte(opcode);
+        byte(0x80 | (reg << 3) | 0x7);
+        imm32(static_cast<uint32_t>(disp));
+    }
+
+    void load_v(uint8_t reg, uint8_t x)  { mem(0x8A, reg, OFF_V + x); }  // mov r8, [Vx]
+    void store_v(uint8_t reg, uint8_t x) { mem(0x88, reg, OFF_V + x); }  // mov [Vx], r8
+
+    // setcc cl; mov [VF], cl
+    void store_flag(uint8_t setcc) {
+        byte(0x0F);
+        byte(setcc);
+        byte(0xC0 | CL);
+        store_v(CL, 0xF);
+    }
+
+    // jcc rel32 to be bound later, returns where its offset goes
+    size_t jump(uint8_t jcc) {
+        byte(0x0F);
+        byte(jcc);
+        imm32(0);
+        return code.size() - 4;
+    }
+
+    // jmp rel32, likewise
+    size_t jump_always() {
+        byte(0xE9);
+        imm32(0);
+        return code.size() - 4;
+    }
+
+    // Points the jump at `at` to target
+    void bind(size_t at, size_t target) {
+        uint32_t rel = uint32_t(target - (at + 4));
+        for (int i = 0; i < 4; ++i) {
+            code[at + i] = (rel >> (8 * i)) & 0xFF;
+        }
+    }
+
+    // eax |= remaining budget (esi) << 16; ret
+    void finish() {
+        byte(0xC1); byte(0xE6); byte(16);  // shl esi, 16
+        byte(0x09); byte(0xF0);            // or eax, esi
+        byte(0xC3);
+    }
+
+    void exit_to(uint16_t pc) {
+        byte(0xB8);
+        imm32(exit_value(pc));  // mov eax, imm32
+        finish();
+    }
+
+    // Exits with emu.pc and the helper's Status in al
+    void exit_dynamic() {
+        byte(0x0F); byte(0xB6); byte(0xC0);  // movzx eax, al
+        byte(0xC1); byte(0xE0); byte(24);    // shl eax, 24
+        byte(0x0F);
+        mem(0xB7, CL, OFF_PC);               // movzx ecx, word [pc]
+        byte(0x09); byte(0xC8);              // or eax, ecx
+        finish();
+    }
+
+    // Every instruction starts by taking one from the budget, leaving with pc
+    // and nothing remaining when there is none
+    void take_budget(uint16_t pc) {
+        byte(0x85); byte(0xF6);  // test esi, esi
+        byte(0x75); byte(6);     // jnz past the exit
+        byte(0xB8);
+        imm32(exit_value(pc));   // mov eax, imm32
+        byte(0xC3);
+        byte(0xFF); byte(0xCE);  // dec esi
+    }
+
+    // emu.pc = pc, then helper(emu, in, span) keeping rdi and rsi, which
+    // leaves its result in eax. Returns the offset of span's imm32.
+    size_t call(uint16_t pc, uint64_t helper, const Instr* in = nullptr) {
+        byte(0x66);
+        mem(0xC7, 0, OFF_PC);
+        imm16(pc);               // mov word [pc], imm16
+        byte(0x57);              // push rdi
+        byte(0x56);              // push rsi
+        byte(0x48); byte(0x83); byte(0xEC); byte(0x08);  // sub rsp, 8
+        size_t span_at = 0;
+        if (in) {
+            byte(0x48); byte(0xBE);
+            imm64(reinterpret_cast<uint64_t>(in));  // mov rsi, imm64
+            byte(0xBA);
+            span_at = code.size();
+            imm32(0);                               // mov edx, imm32
+        }
+        byte(0x48); byte(0xB8);
+        imm64(helper);           // mov rax, imm64
+        byte(0xFF); byte(0xD0);  // call rax
+        byte(0x48); byte(0x83); byte(0xC4); byte(0x08);  // add rsp, 8
+        byte(0x5E);              // pop rsi
+        byte(0x5F);              // pop rdi
+        return span_at;
+    }
+
+    void patch32(size_t at, uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            code[at + i] = (v >> (8 * i)) & 0xFF;
+        }
+    }
+
+    // Calls the helper for in at pc and carries on unless it did not fall
+    // through to pc + 2 or returned anything but Status::Ok. Returns the
+    // offset of the block's span to patch in, see run_store().
+    size_t interpret(uint16_t pc, const Instr* in) {
+        bool store = in->opcode == Opcode::LdBVx || in->opcode == Opcode::LdIVx;
+        size_t span_at = call(pc, store ? reinterpret_cast<uint64_t>(&run_store) : reinterpret_cast<uint64_t>(&run_instr), in);
+        byte(0x85); byte(0xC0);  // test eax, eax
+        size_t failed = jump(JNE);
+        byte(0x66);
+        mem(0x81, 7, OFF_PC);
+        imm16(uint16_t(pc + 2));  // cmp word [pc], imm16
+        size_t fell_through = jump(JE);
+        bind(failed, code.size());
+        exit_dynamic();
+        bind(fell_through, code.size());
+        return span_at;
+    }
+
+    // Copies length bytes between V0 and RAM at eax, in the widest moves that fit
+    void copy(bool to_ram, size_t length) {
+        for (size_t r = 0; r < length;) {
+            size_t width = length - r >= 8 ? 8 : length - r >= 4 ? 4 : length - r >= 2 ? 2 : 1;
+            for (bool store : {false, true}) {
+                if (width == 8)
+                    byte(0x48);
+                else if (width == 2)
+                    byte(0x66);
+                byte(store ? (width == 1 ? 0x88 : 0x89) : (width == 1 ? 0x8A : 0x8B));
+                if (store == to_ram) {
+                    byte(0x8C); byte(0x07);  // rcx, [rdi + rax + disp32]
+                    imm32(uint32_t(OFF_RAM + r));
+                } else {
+                    byte(0x8F);              // rcx, [rdi + disp32]
+                    imm32(uint32_t(OFF_V + r));
+                }
+            }
+            r += width;
+        }
+    }
+
+    // Calls run_tick for the instruction at pc and exits after it
+    void tick(uint16_t pc) {
+        call(pc, reinterpret_cast<uint64_t>(&run_tick));
+        exit_dynamic();
+    }
+
+    static constexpr uint8_t JE = 0x84;
+    static constexpr uint8_t JNE = 0x85;
+    static constexpr uint8_t JAE = 0x83;
+    static constexpr uint8_t JA = 0x87;
+    static constexpr uint8_t JB = 0x82;
+};
+
+constexpr uint8_t SETC = 0x92;
+constexpr uint8_t SETNC = 0x93;
+
+// Emits one straight-line instruction, returns false if it is not compiled
+bool emit_straight(Emitter& e, const Instr& in) {
+    // The interpreter writes VF before reading the operands back, so flag
+    // ops that name VF themselves are left to it rather than reproduced here
+    bool touches_vf = in.x == 0xF || in.y == 0xF;
+
+    switch (in.opcode) {
+        case Opcode::Nop:
+            return true;
+        case Opcode::LdVxNN:
+            e.mem(0xC6, 0, OFF_V + in.x);  // mov byte [Vx], imm8
+            e.byte(in.nn);
+            return true;
+        case Opcode::AddVxNN:
+            e.mem(0x80, 0, OFF_V + in.x);  // add byte [Vx], imm8
+            e.byte(in.nn);
+            return true;
+        case Opcode::LdVxVy:
+            e.load_v(AL, in.y);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::Or:
+            e.load_v(AL, in.y);
+            e.mem(0x08, AL, OFF_V + in.x);  // or [Vx], al
+            return true;
+        case Opcode::And:
+            e.load_v(AL, in.y);
+            e.mem(0x20, AL, OFF_V + in.x);  // and [Vx], al
+            return true;
+        case Opcode::Xor:
+            e.load_v(AL, in.y);
+            e.mem(0x30, AL, OFF_V + in.x);  // xor [Vx], al
+            return true;
+        case Opcode::AddVxVy:
+            if (touches_vf) return false;
+            e.load_v(AL, in.x);
+            e.mem(0x02, AL, OFF_V + in.y);  // add al, [Vy]
+            e.store_flag(SETC);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::Sub:
+            if (touches_vf) return false;
+            e.load_v(AL, in.x);
+            e.mem(0x2A, AL, OFF_V + in.y);  // sub al, [Vy]
+            e.store_flag(SETNC);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::Subn:
+            if (touches_vf) return false;
+            e.load_v(AL, in.y);
+            e.mem(0x2A, AL, OFF_V + in.x);  // sub al, [Vx]
+            e.store_flag(SETNC);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::Shr:
+            if (touches_vf) return false;
+            e.load_v(AL, in.x);
+            e.byte(0xD0);
+            e.byte(0xE8);  // shr al, 1
+            e.store_flag(SETC);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::Shl:
+            if (touches_vf) return false;
+            e.load_v(AL, in.x);
+            e.byte(0xD0);
+            e.byte(0xE0);  // shl al, 1
+            e.store_flag(SETC);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::LdI:
+            e.byte(0x66);
+            e.mem(0xC7, 0, OFF_I);  // mov word [I], imm16
+            e.imm16(in.nnn);
+            return true;
+        case Opcode::AddIVx:
+            e.byte(0x0F);
+            e.mem(0xB6, AL, OFF_V + in.x);  // movzx eax, byte [Vx]
+            e.byte(0x66);
+            e.mem(0x01, AL, OFF_I);  // add [I], ax
+            return true;
+        case Opcode::LdVxDt:
+            e.mem(0x8A, AL, OFF_DT);
+            e.store_v(AL, in.x);
+            return true;
+        case Opcode::LdDtVx:
+            e.load_v(AL, in.x);
+            e.mem(0x88, AL, OFF_DT);
+            return true;
+        case Opcode::LdStVx:
+            e.load_v(AL, in.x);
+            e.mem(0x88, AL, OFF_ST);
+            return true;
+        case Opcode::LdFVx:
+            e.byte(0x0F);
+            e.mem(0xB6, AL, OFF_V + in.x);  // movzx eax, byte [Vx]
+            e.byte(0x8D); e.byte(0x04); e.byte(0x80);  // lea eax, [rax + rax * 4]
+            e.byte(0x66);
+            e.mem(0x89, AL, OFF_I);  // mov [I], ax
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Emits a skip as a jump to the instruction after next, whose offset it
+// returns; false if in is not one
+bool emit_skip(Emitter& e, const Instr& in, size_t& at) {
+    switch (in.opcode) {
+        case Opcode::SeVxNN:
+        case Opcode::SneVxNN:
+            e.mem(0x80, 7, OFF_V + in.x);  // cmp byte [Vx], imm8
+            e.byte(in.nn);
+            at = e.jump(in.opcode == Opcode::SeVxNN ? Emitter::JE : Emitter::JNE);
+            return true;
+        case Opcode::SeVxVy:
+        case Opcode::SneVxVy:
+            e.load_v(AL, in.x);
+            e.mem(0x3A, AL, OFF_V + in.y);  // cmp al, [Vy]
+            at = e.jump(in.opcode == Opcode::SeVxVy ? Emitter::JE : Emitter::JNE);
+            return true;
+        case Opcode::Skp:
+        case Opcode::Sknp:
+            e.byte(0x0F);
+            e.mem(0xB6, AL, OFF_V + in.x);     // movzx eax, byte [Vx]
+            e.byte(0x83); e.byte(0xE0); e.byte(NUM_KEYS - 1);  // and eax, 15
+            e.byte(0x80); e.byte(0xBC); e.byte(0x07);
+            e.imm32(OFF_KEYS);
+            e.byte(0);                         // cmp byte [rdi + rax + keys], 0
+            at = e.jump(in.opcode == Opcode::Skp ? Emitter::JNE : Emitter::JE);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// FX33, FX55 and FX65 while I - 1 to I + X stay inside RAM, else the
+// interpreter, which wraps; false if in is not one of them. Stores do what
+// Emu::invalidate() does for that case and leave the block if they wrote
+// into it.
+bool emit_memory(Emitter& e, const Instr& in, uint16_t pc, std::vector<size_t>& span_fixups) {
+    size_t length;
+    switch (in.opcode) {
+        case Opcode::LdBVx: length = 3; break;
+        case Opcode::LdIVx:
+        case Opcode::LdVxI: length = in.x + 1; break;
+        default: return false;
+    }
+    e.byte(0x0F);
+    e.mem(0xB7, AL, OFF_I);                   // movzx eax, word [I]
+    e.byte(0x8D); e.byte(0x48); e.byte(0xFF);  // lea ecx, [rax - 1]
+    e.byte(0x81); e.byte(0xF9);
+    e.imm32(uint32_t(RAM_SIZE - length - 1));  // cmp ecx, imm32
+    size_t wraps = e.jump(Emitter::JA);
+
+    if (in.opcode == Opcode::LdVxI) {
+        e.copy(false, length);
+    } else {
+        if (in.opcode == Opcode::LdIVx) {
+            e.copy(true, length);
+        } else {
+            e.byte(0x48); e.byte(0xBA);
+            e.imm64(reinterpret_cast<uint64_t>(&BCD));  // mov rdx, imm64
+            e.byte(0x0F);
+            e.mem(0xB6, CL, OFF_V + in.x);    // movzx ecx, byte [Vx]
+            e.byte(0x8B); e.byte(0x0C); e.byte(0x8A);  // mov ecx, [rdx + rcx * 4]
+            e.byte(0x66); e.byte(0x89); e.byte(0x8C); e.byte(0x07);
+            e.imm32(OFF_RAM);                 // mov [rdi + rax + ram], cx
+            e.byte(0xC1); e.byte(0xE9); e.byte(16);  // shr ecx, 16
+            e.byte(0x88); e.byte(0x8C); e.byte(0x07);
+            e.imm32(OFF_RAM + 2);             // mov [rdi + rax + ram + 2], cl
+        }
+
+        // The instruction starting one byte before I also covers it
+        e.byte(0x69); e.byte(0xC8);
+        e.imm32(sizeof(Instr));               // imul ecx, eax, sizeof(Instr)
+        for (int32_t at = -1; at < int32_t(length); ++at) {
+            e.byte(0xC6); e.byte(0x84); e.byte(0x0F);
+            e.imm32(uint32_t(OFF_ICACHE + at * int32_t(sizeof(Instr)) + int32_t(offsetof(Instr, opcode))));
+            e.byte(uint8_t(Opcode::Undecoded));  // mov byte [rdi + rcx + icache[at].opcode], Undecoded
+        }
+        // A page for I and one for I + X, which may be the same
+        for (size_t end : {size_t(0), length - 1}) {
+            e.byte(0x8D); e.byte(0x48); e.byte(uint8_t(end));  // lea ecx, [rax + end]
+            e.byte(0xC1); e.byte(0xE9); e.byte(8);             // shr ecx, 8
+            e.byte(0xBA); e.imm32(1);                          // mov edx, 1
+            e.byte(0xD3); e.byte(0xE2);                        // shl edx, cl
+            e.byte(0x66);
+            e.mem(0x09, DL, OFF_PAGES);                        // or [dirty_pages], dx
+        }
+
+        // Leave if [I, I + X] meets the block's span, patched in later
+        e.byte(0xBA);
+        span_fixups.push_back(e.code.size());
+        e.imm32(0);                                 // mov edx, span
+        e.byte(0x0F); e.byte(0xB7); e.byte(0xCA);   // movzx ecx, dx
+        e.byte(0xC1); e.byte(0xEA); e.byte(16);     // shr edx, 16
+        e.byte(0x39); e.byte(0xD0);                 // cmp eax, edx
+        size_t after = e.jump(Emitter::JA);
+        e.byte(0x8D); e.byte(0x50); e.byte(uint8_t(length - 1));  // lea edx, [rax + length - 1]
+        e.byte(0x39); e.byte(0xCA);                 // cmp edx, ecx
+        size_t before = e.jump(Emitter::JB);
+        e.exit_to(uint16_t(pc + 2));
+        e.bind(after, e.code.size());
+        e.bind(before, e.code.size());
+    }
+    size_t done = e.jump_always();
+    e.bind(wraps, e.code.size());
+    span_fixups.push_back(e.interpret(pc, &in));
+    e.bind(done, e.code.size());
+    return true;
+}
+
+// DXYN in low resolution while the sprite stays inside RAM, as
+// Emu::draw_lores() draws it with the default quirks, else the interpreter
+bool emit_draw(Emitter& e, const Instr& in, uint16_t pc, std::vector<size_t>& span_fixups) {
+    if (in.opcode != Opcode::Drw || in.n == 0)
+        return false;
+    e.mem(0x80, 7, OFF_HIRES);
+    e.byte(0);                       // cmp byte [hires], 0
+    size_t hires = e.jump(Emitter::JNE);
+    e.byte(0x0F);
+    e.mem(0xB7, AL, OFF_I);          // movzx eax, word [I]
+    e.byte(0x3D);
+    e.imm32(uint32_t(RAM_SIZE - in.n));  // cmp eax, imm32
+    size_t wraps = e.jump(Emitter::JA);
+
+    // VF is cleared first, so DXYN with X or Y = F draws at 0
+    e.mem(0xC6, 0, OFF_V + 0xF);
+    e.byte(0);                       // mov byte [VF], 0
+    e.byte(0x0F);
+    e.mem(0xB6, CL, OFF_V + in.x);   // movzx ecx, byte [Vx]
+    e.byte(0x83); e.byte(0xE1); e.byte(SCREEN_WIDTH - 1);  // and ecx, 63
+    e.byte(0x0F);
+    e.mem(0xB6, DL, OFF_V + in.y);   // movzx edx, byte [Vy]
+    e.byte(0x45); e.byte(0x31); e.byte(0xC9);  // xor r9d, r9d
+
+    for (uint8_t row = 0; row < in.n; ++row) {
+        e.byte(0x44); e.byte(0x0F); e.byte(0xB6); e.byte(0x9C); e.byte(0x07);
+        e.imm32(uint32_t(OFF_RAM + row));            // movzx r11d, byte [rdi + rax + ram + row]
+        e.byte(0x49); e.byte(0xC1); e.byte(0xE3); e.byte(56);  // shl r11, 56
+        e.byte(0x49); e.byte(0xD3); e.byte(0xCB);    // ror r11, cl
+        e.byte(0x44); e.byte(0x8D); e.byte(0x42); e.byte(row);  // lea r8d, [rdx + row]
+        e.byte(0x41); e.byte(0x83); e.byte(0xE0); e.byte(SCREEN_HEIGHT - 1);  // and r8d, 31
+        e.byte(0x4E); e.byte(0x85); e.byte(0x9C); e.byte(0xC7);
+        e.imm32(OFF_SCREEN);                         // test [rdi + r8 * 8 + screen], r11
+        e.byte(0x74); e.byte(7);                     // jz past the flag
+        e.mem(0xC6, 0, OFF_V + 0xF);
+        e.byte(1);                                   // mov byte [VF], 1
+        e.byte(0x4E); e.byte(0x31); e.byte(0x9C); e.byte(0xC7);
+        e.imm32(OFF_SCREEN);                         // xor [rdi + r8 * 8 + screen], r11
+        e.byte(0x4D); e.byte(0x85); e.byte(0xDB);    // test r11, r11
+        e.byte(0x74); e.byte(4);                     // jz past the bts
+        e.byte(0x4D); e.byte(0x0F); e.byte(0xAB); e.byte(0xC1);  // bts r9, r8
+    }
+
+    e.byte(0x4D); e.byte(0x85); e.byte(0xC9);  // test r9, r9
+    e.byte(0x74); e.byte(13);                  // jz past the bookkeeping
+    e.byte(0x4C);
+    e.mem(0x09, 1, OFF_DIRTY);                 // or [dirty_rows], r9
+    e.mem(0xFF, 0, OFF_GEN);                   // inc dword [display_gen]
+    size_t done = e.jump_always();
+    e.bind(hires, e.code.size());
+    e.bind(wraps, e.code.size());
+    span_fixups.push_back(e.interpret(pc, &in));
+    e.bind(done, e.code.size());
+    return true;
+}
+
+// 2NNN's push: jumps to the interpreter, which traps, on a full stack
+void emit_push_return(Emitter& e, uint16_t pc) {
+    e.byte(0x0F);
+    e.mem(0xB7, AL, OFF_SP);           // movzx eax, word [sp]
+    e.byte(0x83); e.byte(0xF8); e.byte(STACK_SIZE);  // cmp eax, STACK_SIZE
+    size_t full = e.jump(Emitter::JAE);
+    e.byte(0x66); e.byte(0xC7); e.byte(0x84); e.byte(0x47);
+    e.imm32(OFF_STACK);
+    e.imm16(pc);                       // mov word [rdi + rax * 2 + stack], pc
+    e.byte(0x66);
+    e.mem(0xFF, 0, OFF_SP);            // inc word [sp]
+    size_t done = e.jump_always();
+    e.bind(full, e.code.size());
+    e.tick(pc);
+    e.bind(done, e.code.size());
+}
+
+// 00EE's pop, leaving where it returns to in eax; likewise on an empty stack
+void emit_pop_return(Emitter& e, uint16_t pc) {
+    e.byte(0x0F);
+    e.mem(0xB7, AL, OFF_SP);           // movzx eax, word [sp]
+    e.byte(0x85); e.byte(0xC0);        // test eax, eax
+    size_t empty = e.jump(Emitter::JE);
+    e.byte(0xFF); e.byte(0xC8);        // dec eax
+    e.byte(0x66);
+    e.mem(0x89, AL, OFF_SP);           // mov word [sp], ax
+    e.byte(0x0F); e.byte(0xB7); e.byte(0x84); e.byte(0x47);
+    e.imm32(OFF_STACK);                // movzx eax, word [rdi + rax * 2 + stack]
+    e.byte(0x83); e.byte(0xC0); e.byte(2);  // add eax, 2
+    e.byte(0x0F); e.byte(0xB7); e.byte(0xC0);  // movzx eax, ax
+    size_t done = e.jump_always();
+    e.bind(empty, e.code.size());
+    e.tick(pc);
+    e.bind(done, e.code.size());
+}
+
+}  // namespace
+
+Jit::Jit() : buffer(nullptr), used(0), verify(false), blocks(RAM_SIZE), owner(RAM_SIZE) {
+#if CHIP8_JIT_SUPPORTED
+    void* mem = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+        buffer = static_cast<uint8_t*>(mem);
+#endif
+}
+
+Jit::~Jit() {
+#if CHIP8_JIT_SUPPORTED
+    if (buffer)
+        munmap(buffer, JIT_BUFFER_SIZE);
+#endif
+}
+
+bool Jit::available() const {
+    return buffer != nullptr;
+}
+
+void Jit::set_verify(bool on) {
+    verify = on;
+}
+
+void Jit::flush() {
+    std::fill(blocks.begin(), blocks.end(), Block{});
+    used = 0;
+}
+
+Jit::Block Jit::compile(const Emu& emu, uint16_t start) {
+    // A trace follows jumps and calls, and returns to the instruction after
+    // the call, checked at run time; it ends on a jump back into the block,
+    // a return it cannot predict or a trap. Skips start another trace if
+    // there is room for it, else leave the block.
+    struct Trace {
+        uint16_t pc;
+        std::vector<uint16_t> calls;  // pcs of the 2NNNs still to return
+    };
+    Emitter e;
+    Block block;
+    // The helpers are handed pointers into instrs, so it must not grow
+    block.instrs.reserve(JIT_MAX_BLOCK_INSTRS);
+    // Code offset by pc; skips past the end of RAM land up to 4 bytes out
+    std::vector<int32_t> label(RAM_SIZE + 4, -1);
+    std::vector<std::pair<size_t, uint16_t>> links;  // jump offset, pc it goes to
+    std::vector<size_t> span_fixups;
+    std::vector<Trace> traces{{start, {}}};
+
+    while (!traces.empty()) {
+        Trace trace = std::move(traces.back());
+        traces.pop_back();
+        uint16_t pc = trace.pc;
+        while (true) {
+            if (size_t(pc) + 1 < RAM_SIZE && label[pc] >= 0) {
+                links.emplace_back(e.jump_always(), pc);
+                break;
+            }
+            if (size_t(pc) + 1 >= RAM_SIZE || block.instrs.size() == JIT_MAX_BLOCK_INSTRS) {
+                e.exit_to(pc);
+                break;
+            }
+            label[pc] = int32_t(e.code.size());
+            block.entries.emplace_back(pc, uint32_t(e.code.size()));
+            e.take_budget(pc);
+            block.instrs.push_back(decode_instr((emu.ram[pc] << 8) | emu.ram[pc + 1]));
+            const Instr& in = block.instrs.back();
+
+            size_t skip_at;
+            if (emit_straight(e, in)) {
+                pc += 2;
+            } else if (emit_skip(e, in, skip_at)) {
+                links.emplace_back(skip_at, uint16_t(pc + 4));
+                traces.push_back({uint16_t(pc + 4), trace.calls});
+                pc += 2;
+            } else if (emit_memory(e, in, pc, span_fixups) || emit_draw(e, in, pc, span_fixups)) {
+                pc += 2;
+            } else if (in.opcode == Opcode::Jp) {
+                pc = in.nnn;
+            } else if (in.opcode == Opcode::Call) {
+                emit_push_return(e, pc);
+                trace.calls.push_back(pc);
+                pc = in.nnn;
+            } else if (in.opcode == Opcode::Ret) {
+                emit_pop_return(e, pc);
+                if (trace.calls.empty()) {
+                    e.finish();
+                    break;
+                }
+                uint16_t back = trace.calls.back() + 2;
+                trace.calls.pop_back();
+                e.byte(0x3D);
+                e.imm32(back);           // cmp eax, back
+                e.byte(0x74); e.byte(6); // je past the exit
+                e.finish();
+                pc = back;
+            } else if (in.opcode >= Opcode::LdILong) {
+                // What QuirkProfile::Default traps
+                e.tick(pc);
+                break;
+            } else {
+                span_fixups.push_back(e.interpret(pc, &in));
+                // BNNN only goes on here if it lands right after itself
+                if (in.opcode == Opcode::JpV0) {
+                    e.exit_to(uint16_t(pc + 2));
+                    break;
+                }
+                pc += 2;
+            }
+        }
+    }
+
+    // Jumps to pcs left out of the block leave it
+    for (const auto& link : links) {
+        if (label[link.second] < 0) {
+            label[link.second] = int32_t(e.code.size());
+            e.exit_to(link.second);
+        }
+        e.bind(link.first, size_t(label[link.second]));
+    }
+
+    std::sort(block.entries.begin(), block.entries.end());
+    uint16_t low = block.entries.front().first;
+    uint16_t high = block.entries.back().first + 1;
+    for (size_t at : span_fixups) {
+        e.patch32(at, low | uint32_t(high) << 16);
+    }
+    for (const auto& entry : block.entries) {
+        uint16_t pc = entry.first;
+        if (block.ranges.empty() || block.ranges.back().first + block.ranges.back().second != pc)
+            block.ranges.emplace_back(pc, 0);
+        block.ranges.back().second += 2;
+        block.source.push_back(emu.ram[pc]);
+        block.source.push_back(emu.ram[pc + 1]);
+    }
+
+#if CHIP8_JIT_SUPPORTED
+    if (used + e.code.size() > JIT_BUFFER_SIZE)
+        flush();
+    mprotect(buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+    std::memcpy(buffer + used, e.code.data(), e.code.size());
+    mprotect(buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+    block.code = buffer + used;
+    used += e.code.size();
+#endif
+    return block;
+}
+
+bool Jit::fresh(const Block& block, const Emu& emu) {
+    const uint8_t* source = block.source.data();
+    for (const auto& range : block.ranges) {
+        if (std::memcmp(emu.ram + range.first, source, range.second) != 0)
+            return false;
+        source += range.second;
+    }
+    return !block.ranges.empty();
+}
+
+RunResult Jit::interpret(Emu& emu) {
+    RunResult result{1, StopReason::Budget, emu.tick(), 0};
+    if (result.status != Status::Ok) {
+        result.stop = StopReason::Trap;
+        result.traps = result.status == Status::Trapped;
+    }
+    return result;
+}
+
+RunResult Jit::step(Emu& emu, uint32_t max_instructions) {
+    uint16_t start = emu.pc;
+    // Generated code has the default quirks baked in and does not trace
+    if (!available() || emu.quirks != QuirkProfile::Default || emu.tracer || size_t(start) + 1 >= RAM_SIZE)
+        return interpret(emu);
+
+    // Enter the block that starts at pc or else the one pc lies inside, and
+    // only compile a new one when neither is current
+    Block* block = &blocks[start];
+    uint32_t offset = 0;
+    if (!fresh(*block, emu)) {
+        Block& owning = blocks[owner[start]];
+        auto entry = std::lower_bound(owning.entries.begin(), owning.entries.end(),
+                                      std::make_pair(start, uint32_t(0)));
+        if (entry != owning.entries.end() && entry->first == start && fresh(owning, emu)) {
+            block = &owning;
+            offset = entry->second;
+        } else {
+            *block = compile(emu, start);
+            for (const auto& compiled : block->entries) {
+                owner[compiled.first] = start;
+            }
+        }
+    }
+
+    // What is left of the budget comes back in 8 bits
+    auto fn = reinterpret_cast<BlockFn>(block->code + offset);
+    uint32_t budget = std::min<uint32_t>(std::max<uint32_t>(max_instructions, 1), 0xFF);
+    uint32_t exit;
+    uint32_t cycles;
+    if (verify) {
+        // On the heap: a copy on the stack would be probed page by page on every step
+        auto reference = std::make_unique<Emu>(emu);
+        exit = fn(&emu, budget);
+        cycles = budget - ((exit >> 16) & 0xFF);
+        for (uint32_t i = 0; i < cycles; ++i) {
+            reference->tick();
+        }
+        emu.pc = exit & 0xFFFF;
+        verify_block(*reference, emu, cycles);
+    } else {
+        exit = fn(&emu, budget);
+        cycles = budget - ((exit >> 16) & 0xFF);
+        emu.pc = exit & 0xFFFF;
+    }
+
+    RunResult result{cycles, StopReason::Budget, static_cast<Status>(exit >> 24), 0};
+    if (result.status != Status::Ok) {
+        result.stop = StopReason::Trap;
+        result.traps = result.status == Status::Trapped;
+    }
+    return result;
+}
+
+RunResult Jit::run_frame(Emu& emu) {
+    RunResult frame{0, StopReason::Budget, Status::Ok, 0};
+    while (frame.cycles < TICKS_PER_FRAME) {
+        RunResult result = step(emu, uint32_t(TICKS_PER_FRAME - frame.cycles));
+        frame.cycles += result.cycles;
+        frame.traps += result.traps;
+        if (result.status == Status::Halted) {
+            frame.stop = StopReason::Trap;
+            frame.status = Status::Halted;
+            break;
+        }
+    }
+    if (frame.status != Status::Halted && frame.traps > 0)
+        frame.status = Status::Trapped;
+    emu.tick_timers();
+    return frame;
+}
+
+void Jit::verify_block(const Emu& expected, const Emu& actual, size_t num_instrs) const {
+    bool same = expected.pc == actual.pc
+        && expected.i_reg == actual.i_reg
+        && expected.sp == actual.sp
+        && expected.dt == actual.dt
+        && expected.st == actual.st
+        && std::equal(expected.v_reg, expected.v_reg + NUM_REGS, actual.v_reg)
+        && std::equal(expected.stack, expected.stack + STACK_SIZE, actual.stack)
+        && std::equal(expected.ram, expected.ram + RAM_SIZE, actual.ram)
+        && std::equal(expected.screen, expected.screen + SCREEN_HEIGHT, actual.screen)
+        && expected.hires == actual.hires
+        && expected.display_gen == actual.display_gen
+        && expected.dirty_rows == actual.dirty_rows
+        && std::equal(expected.hires_screen, expected.hires_screen + HIRES_HEIGHT * HIRES_ROW_WORDS,
+                      actual.hires_screen)
+        && expected.dirty_pages == actual.dirty_pages;
+    // Blocks decode nothing into icache, but must drop what they overwrite
+    for (size_t pc = 0; same && pc + 1 < RAM_SIZE; ++pc) {
+        const Instr& cached = actual.icache[pc];
+        same = cached.opcode == Opcode::Undecoded || cached.op == (actual.ram[pc] << 8 | actual.ram[pc + 1]);
+    }
+    if (same)
+        return;
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "JIT mismatch after %zu instructions: pc 0x%03X vs 0x%03X, I 0x%03X vs 0x%03X",
+             num_instrs, expected.pc, actual.pc, expected.i_reg, actual.i_reg);
+    throw std::runtime_error(message);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "core.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// x86-64 (System V) dynamic recompiler. Blocks of up to JIT_MAX_BLOCK_INSTRS
+// instructions follow jumps, calls and returns, so a loop usually runs inside
+// one block. Register ops, control flow, FX33/FX55/FX65 and low resolution
+// DXYN are translated to native code, the rest is called through
+// Emu::execute() from inside the block. An Emu
+// whose quirks are not QuirkProfile::Default or that has a tracer attached is
+// only ever ticked.
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+constexpr size_t JIT_BUFFER_SIZE = 1 << 20;
+constexpr size_t JIT_MAX_BLOCK_INSTRS = 64;
+
+class Jit {
+public:
+    Jit();
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // False when the platform is unsupported or the code buffer could not be mapped
+    bool available() const;
+
+    // Runs the block at emu.pc, or the one emu.pc lies in from there, for at
+    // most max_instructions (at least one, at most 255). The block stops
+    // after an instruction that traps, passing its Status on with
+    // StopReason::Trap.
+    // Callers should stop on Status::Halted.
+    RunResult step(Emu& emu, uint32_t max_instructions = JIT_MAX_BLOCK_INSTRS);
+
+    // Emu::run_frame() through step(): exactly TICKS_PER_FRAME instructions
+    // unless one halts, then tick_timers(), so frames match the interpreter's
+    RunResult run_frame(Emu& emu);
+
+    // Differential mode: every block is replayed on a copy through the
+    // interpreter and the two states are compared, throwing on mismatch
+    void set_verify(bool on);
+
+    // Drops every compiled block
+    void flush();
+
+private:
+    // Runs at most `budget` instructions from where it is entered, less if
+    // one leaves the block. Returns the new pc, the budget left in bits 16-23
+    // and the Status of the last instruction in bits 24-31.
+    using BlockFn = uint32_t (*)(Emu* emu, uint32_t budget);
+
+    struct Block {
+        uint8_t* code = nullptr;
+        // Decoded once for the helpers the code calls, see Emu::execute()
+        std::vector<Instr> instrs;
+        // Offset into code of each instruction by pc, sorted, so a block can
+        // be entered part way
+        std::vector<std::pair<uint16_t, uint32_t>> entries;
+        // Source bytes, rechecked on entry to catch self-modifying code: the
+        // runs of RAM compiled as (start, length), then their bytes in order
+        std::vector<std::pair<uint16_t, uint16_t>> ranges;
+        std::vector<uint8_t> source;
+    };
+
+    Block compile(const Emu& emu, uint16_t start);
+    static bool fresh(const Block& block, const Emu& emu);
+    static RunResult interpret(Emu& emu);
+    void verify_block(const Emu& before, const Emu& after, size_t num_instrs) const;
+
+    uint8_t* buffer;
+    size_t used;
+    bool verify;
+    std::vector<Block> blocks;
+    // Start of the last block compiled over each address
+    std::vector<uint16_t> owner;
+};
@@ -0,0 +1,164 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+// Delta format: a sequence of [u16 skip][u16 count][count bytes to XOR in].
+// A literal run only ends on this many unchanged bytes, so isolated equal
+// bytes inside a changed region do not cost a new 4-byte header.
+constexpr size_t MIN_ZERO_RUN = 4;
+// Longer skips and literals than fit a u16 are split over several entries
+constexpr size_t MAX_RUN = 0xFFFF;
+
+static void put_u16(std::vector<uint8_t>& out, size_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+}
+
+static size_t get_u16(const uint8_t* in) {
+    return in[0] | (in[1] << 8);
+}
+
+static void encode_delta(const uint8_t* from, const uint8_t* to, size_t length, std::vector<uint8_t>& out) {
+    out.clear();
+    size_t i = 0;
+    while (i < length) {
+        size_t skip_start = i;
+        while (i < length && from[i] == to[i]) {
+            ++i;
+        }
+        if (i == length)
+            break;
+
+        size_t literal_start = i;
+        size_t zeros = 0;
+        while (i < length && zeros < MIN_ZERO_RUN) {
+            zeros = (from[i] == to[i]) ? zeros + 1 : 0;
+            ++i;
+        }
+        size_t literal_end = i - zeros;
+
+        size_t skip = literal_start - skip_start;
+        for (; skip > MAX_RUN; skip -= MAX_RUN) {
+            put_u16(out, MAX_RUN);
+            put_u16(out, 0);
+        }
+        for (size_t start = literal_start; start < literal_end; start += MAX_RUN) {
+            size_t count = std::min(literal_end - start, MAX_RUN);
+            put_u16(out, skip);
+            put_u16(out, count);
+            for (size_t j = start; j < start + count; ++j) {
+                out.push_back(from[j] ^ to[j]);
+            }
+            skip = 0;
+        }
+        i = literal_end;
+    }
+}
+
+static void apply_delta(const uint8_t* delta, size_t length, uint8_t* state) {
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < length) {
+        pos += get_u16(delta + i);
+        size_t count = get_u16(delta + i + 2);
+        i += 4;
+        for (size_t j = 0; j < count; ++j) {
+            state[pos + j] ^= delta[i + j];
+        }
+        pos += count;
+        i += count;
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t capacity_bytes)
+    : ring(std::max<size_t>(capacity_bytes, 1)), tail(0), used(0), has_newest(false),
+      newest(std::make_unique<EmuState>()), current(std::make_unique<EmuState>()) {
+}
+
+size_t RewindBuffer::frames() const {
+    return sizes.size();
+}
+
+size_t RewindBuffer::used_bytes() const {
+    return used;
+}
+
+void RewindBuffer::clear() {
+    sizes.clear();
+    tail = 0;
+    used = 0;
+    has_newest = false;
+}
+
+void RewindBuffer::write_ring(const uint8_t* data, size_t length) {
+    // Unchanged frames give an empty delta, whose data() may be null
+    if (length == 0)
+        return;
+    size_t head = (tail + used) % ring.size();
+    size_t first = std::min(length, ring.size() - head);
+    std::memcpy(ring.data() + head, data, first);
+    std::memcpy(ring.data(), data + first, length - first);
+    used += length;
+}
+
+void RewindBuffer::read_ring(size_t offset, size_t length, uint8_t* out) const {
+    if (length == 0)
+        return;
+    size_t first = std::min(length, ring.size() - offset);
+    std::memcpy(out, ring.data() + offset, first);
+    std::memcpy(out + first, ring.data(), length - first);
+}
+
+void RewindBuffer::push(const Emu& emu) {
+    save_state(emu, *current);
+    if (!has_newest) {
+        std::swap(newest, current);
+        has_newest = true;
+        return;
+    }
+
+    // save_state() stops at state_size(), so when the profile changed the
+    // shorter state's tail is zeroed for the delta to cover both
+    size_t current_size = state_size(*current);
+    size_t newest_size = state_size(*newest);
+    size_t length = std::max(current_size, newest_size);
+    std::memset(reinterpret_cast<uint8_t*>(current.get()) + current_size, 0, length - current_size);
+    std::memset(reinterpret_cast<uint8_t*>(newest.get()) + newest_size, 0, length - newest_size);
+    encode_delta(reinterpret_cast<const uint8_t*>(current.get()),
+                 reinterpret_cast<const uint8_t*>(newest.get()), length, scratch);
+    std::swap(newest, current);
+
+    if (scratch.size() > ring.size()) {
+        // Cannot hold even one delta, history restarts here
+        sizes.clear();
+        tail = 0;
+        used = 0;
+        return;
+    }
+    while (used + scratch.size() > ring.size()) {
+        tail = (tail + sizes.front()) % ring.size();
+        used -= sizes.front();
+        sizes.pop_front();
+    }
+    write_ring(scratch.data(), scratch.size());
+    sizes.push_back(scratch.size());
+}
+
+size_t RewindBuffer::rewind(Emu& emu, size_t frames) {
+    size_t rewound = 0;
+    while (rewound < frames && !sizes.empty()) {
+        size_t length = sizes.back();
+        size_t offset = (tail + used - length) % ring.size();
+        scratch.resize(length);
+        read_ring(offset, length, scratch.data());
+        apply_delta(scratch.data(), length, reinterpret_cast<uint8_t*>(newest.get()));
+        used -= length;
+        sizes.pop_back();
+        rewound++;
+    }
+    if (rewound > 0)
+        load_state(*newest, emu);
+    return rewound;
+}
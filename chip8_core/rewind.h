@@ -0,0 +1,47 @@
+#pragma once
+
+#include "state.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Fixed-memory history of machine states. The newest state is kept in full;
+// each older one is stored as the run-length encoded XOR against its successor,
+// so stepping back is one decode-and-XOR per frame.
+class RewindBuffer {
+public:
+    explicit RewindBuffer(size_t capacity_bytes);
+
+    // Records the current state as the newest frame, evicting the oldest if full
+    void push(const Emu& emu);
+
+    // Steps back up to `frames` frames and loads that state into emu.
+    // Returns how many frames were actually rewound.
+    size_t rewind(Emu& emu, size_t frames);
+
+    // Frames that can still be rewound
+    size_t frames() const;
+
+    // Bytes of delta storage in use
+    size_t used_bytes() const;
+
+    void clear();
+
+private:
+    void write_ring(const uint8_t* data, size_t length);
+    void read_ring(size_t offset, size_t length, uint8_t* out) const;
+
+    std::vector<uint8_t> ring;
+    size_t tail;     // offset of the oldest delta
+    size_t used;
+    std::deque<size_t> sizes;  // delta sizes, oldest first
+
+    bool has_newest;
+    // Swapped after every push rather than copied
+    std::unique_ptr<EmuState> newest;
+    std::unique_ptr<EmuState> current;
+    std::vector<uint8_t> scratch;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// splitmix64, used to spread a seed over generator state
+inline uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint32_t rotl32(uint32_t value, unsigned shift) {
+    return (value << shift) | (value >> (32 - shift));
+}
+
+// xoshiro128**. Plain data so it can live in Emu, MachineState and save blobs.
+struct Rng {
+    uint32_t s[4];
+
+    void seed(uint64_t value) {
+        uint64_t a = splitmix64(value);
+        uint64_t b = splitmix64(value);
+        s[0] = uint32_t(a);
+        s[1] = uint32_t(a >> 32);
+        s[2] = uint32_t(b);
+        s[3] = uint32_t(b >> 32);
+    }
+
+    uint32_t next() {
+        uint32_t result = rotl32(s[1] * 5, 7) * 9;
+        uint32_t t = s[1] << 9;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl32(s[3], 11);
+        return result;
+    }
+
+    // The high bits are the strongest
+    uint8_t next_byte() {
+        return uint8_t(next() >> 24);
+    }
+};
+
+// The same generator for many lanes in structure-of-arrays layout, so one
+// call steps every lane with plain 32-bit loops the compiler can vectorize.
+// Lane l produces the same sequence as an Rng with s = {s0[l], s1[l], s2[l], s3[l]}.
+inline void rng_next_bytes(uint32_t* s0, uint32_t* s1, uint32_t* s2, uint32_t* s3,
+                           size_t first, size_t last, uint8_t* out) {
+    for (size_t l = first; l < last; ++l) {
+        uint32_t result = rotl32(s1[l] * 5, 7) * 9;
+        uint32_t t = s1[l] << 9;
+        s2[l] ^= s0[l];
+        s3[l] ^= s1[l];
+        s1[l] ^= s2[l];
+        s0[l] ^= s3[l];
+        s2[l] ^= t;
+        s3[l] = rotl32(s3[l], 11);
+        out[l] = uint8_t(result >> 24);
+    }
+}
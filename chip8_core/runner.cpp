@@ -0,0 +1,185 @@
+#include "runner.h"
+
+#include <algorithm>
+#include <chrono>
+
+Runner::Runner(size_t num_threads) : outstanding(0), stopping(false) {
+    num_threads = std::max<size_t>(num_threads, 1);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back(&Runner::run, this, i);
+    }
+}
+
+Runner::~Runner() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t Runner::num_workers() const {
+    return workers.size();
+}
+
+WorkerStats Runner::stats(size_t worker) const {
+    const Worker& w = *workers[worker];
+    WorkerStats s;
+    s.jobs = w.jobs_done.load(std::memory_order_relaxed);
+    s.frames = w.frames.load(std::memory_order_relaxed);
+    s.skipped = w.skipped.load(std::memory_order_relaxed);
+    s.instructions = w.instructions.load(std::memory_order_relaxed);
+    s.steals = w.steals.load(std::memory_order_relaxed);
+    s.busy_ns = w.busy_ns.load(std::memory_order_relaxed);
+    return s;
+}
+
+std::future<void> Runner::submit(Emu& emu, size_t frames) {
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> result = promise->get_future();
+    submit(emu, frames, [promise](std::exception_ptr error) {
+        if (error)
+            promise->set_exception(error);
+        else
+            promise->set_value();
+    });
+    return result;
+}
+
+void Runner::submit(Emu& emu, size_t frames, Callback done) {
+    if (frames == 0) {
+        done(nullptr);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        outstanding++;
+    }
+    size_t worker = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    push(worker, Job{&emu, frames, std::move(done)});
+}
+
+void Runner::wait_idle() {
+    std::unique_lock<std::mutex> guard(idle_lock);
+    all_done.wait(guard, [this] { return outstanding == 0; });
+}
+
+void Runner::push(size_t worker, Job job) {
+    {
+        std::lock_guard<std::mutex> guard(workers[worker]->lock);
+        workers[worker]->jobs.push_back(std::move(job));
+    }
+    queued.fetch_add(1);
+    // Only touch the shared lock when someone may be asleep
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        work_ready.notify_one();
+    }
+}
+
+bool Runner::pop_local(size_t worker, Job& job) {
+    {
+        std::lock_guard<std::mutex> guard(workers[worker]->lock);
+        std::deque<Job>& jobs = workers[worker]->jobs;
+        if (jobs.empty())
+            return false;
+        job = std::move(jobs.back());
+        jobs.pop_back();
+    }
+    queued.fetch_sub(1);
+    return true;
+}
+
+bool Runner::steal(size_t thief, Job& job) {
+    size_t n = workers.size();
+    for (size_t offset = 1; offset < n; ++offset) {
+        Worker& victim = *workers[(thief + offset) % n];
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.jobs.empty())
+                continue;
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+        workers[thief]->steals.fetch_add(1, std::memory_order_relaxed);
+        queued.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void Runner::run(size_t worker) {
+    while (true) {
+        Job job;
+        if (pop_local(worker, job) || steal(worker, job)) {
+            execute(worker, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(idle_lock);
+        sleeping.fetch_add(1);
+        work_ready.wait(guard, [this] { return queued.load() > 0 || stopping; });
+        sleeping.fetch_sub(1);
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
+
+void Runner::execute(size_t worker, Job& job) {
+    Worker& w = *workers[worker];
+    size_t chunk = std::min(job.frames, RUNNER_CHUNK_FRAMES);
+    std::exception_ptr error;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t frames_run = 0;
+    size_t frames_skipped = 0;
+    uint64_t instructions = 0;
+    bool halted = false;
+    try {
+        while (frames_run < chunk) {
+            // Jobs get no input, so a wait loop can be jumped over in one go
+            size_t idle = job.emu->fast_forward(chunk - frames_run);
+            if (idle > 0) {
+                frames_run += idle;
+                frames_skipped += idle;
+                continue;
+            }
+            RunResult frame = job.emu->run_frame();
+            instructions += frame.cycles;
+            frames_run++;
+            if (frame.status == Status::Halted) {
+                halted = true;
+                break;
+            }
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    w.frames.fetch_add(frames_run, std::memory_order_relaxed);
+    w.skipped.fetch_add(frames_skipped, std::memory_order_relaxed);
+    w.instructions.fetch_add(instructions, std::memory_order_relaxed);
+    w.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                        std::memory_order_relaxed);
+
+    job.frames -= frames_run;
+    if (!error && !halted && job.frames > 0) {
+        // Requeue the rest so an idle worker can steal it
+        push(worker, std::move(job));
+        return;
+    }
+
+    w.jobs_done.fetch_add(1, std::memory_order_relaxed);
+    job.done(error);
+
+    std::lock_guard<std::mutex> guard(idle_lock);
+    outstanding--;
+    if (outstanding == 0)
+        all_done.notify_all();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "core.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Jobs longer than this are split so idle workers can steal the rest
+constexpr size_t RUNNER_CHUNK_FRAMES = 60;
+
+struct WorkerStats {
+    uint64_t jobs;         // jobs finished on this worker
+    uint64_t frames;       // frames run on this worker
+    uint64_t skipped;      // of those, frames fast-forwarded through a wait loop
+    uint64_t instructions; // instructions retired on this worker
+    uint64_t steals;       // chunks taken from another worker's deque
+    uint64_t busy_ns;      // time spent running frames
+};
+
+// Runs "K frames" jobs for independent Emu instances on a pool of threads.
+// Each worker owns a deque: it pops its own work from the back and steals
+// from the front of the others when it runs dry.
+class Runner {
+public:
+    using Callback = std::function<void(std::exception_ptr error)>;
+
+    explicit Runner(size_t num_threads = std::thread::hardware_concurrency());
+    ~Runner();
+
+    Runner(const Runner&) = delete;
+    Runner& operator=(const Runner&) = delete;
+
+    // The Emu must stay alive and untouched by the caller until the job completes.
+    // A job ends early, without an error, once tick() returns Status::Halted.
+    std::future<void> submit(Emu& emu, size_t frames);
+
+    // done runs on the worker thread; error is null on success
+    void submit(Emu& emu, size_t frames, Callback done);
+
+    // Blocks until every submitted job has completed
+    void wait_idle();
+
+    size_t num_workers() const;
+
+    WorkerStats stats(size_t worker) const;
+
+private:
+    struct Job {
+        Emu* emu;
+        size_t frames;
+        Callback done;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex lock;
+        std::deque<Job> jobs;
+        std::atomic<uint64_t> jobs_done{0};
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> skipped{0};
+        std::atomic<uint64_t> instructions{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> busy_ns{0};
+    };
+
+    void push(size_t worker, Job job);
+    bool pop_local(size_t worker, Job& job);
+    bool steal(size_t thief, Job& job);
+    void run(size_t worker);
+    void execute(size_t worker, Job& job);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // Chunks sitting in any deque, and workers parked waiting for one
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleeping{0};
+
+    // idle_lock guards outstanding and stopping and the two condition variables
+    std::mutex idle_lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    size_t outstanding;
+    bool stopping;
+
+    std::atomic<size_t> next_worker{0};
+};
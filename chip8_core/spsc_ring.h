@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool try_push(const T& value) {
+        size_t head = write_pos.load(std::memory_order_relaxed);
+        if (head - read_pos.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[head & (Capacity - 1)] = value;
+        write_pos.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pushes as many of the count items as fit, returns how many were taken
+    size_t push_many(const T* in, size_t count) {
+        size_t head = write_pos.load(std::memory_order_relaxed);
+        size_t space = Capacity - (head - read_pos.load(std::memory_order_acquire));
+        if (count > space)
+            count = space;
+        for (size_t i = 0; i < count; ++i) {
+            slots[(head + i) & (Capacity - 1)] = in[i];
+        }
+        write_pos.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    bool try_pop(T& out) {
+        size_t tail = read_pos.load(std::memory_order_relaxed);
+        if (tail == write_pos.load(std::memory_order_acquire))
+            return false;
+        out = slots[tail & (Capacity - 1)];
+        read_pos.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Pops up to max_count items into out, returns how many were taken
+    size_t pop_many(T* out, size_t max_count) {
+        size_t tail = read_pos.load(std::memory_order_relaxed);
+        size_t available = write_pos.load(std::memory_order_acquire) - tail;
+        size_t count = available < max_count ? available : max_count;
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = slots[(tail + i) & (Capacity - 1)];
+        }
+        read_pos.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate when called from a third thread
+    size_t size() const {
+        return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity;
+    }
+
+private:
+    T slots[Capacity];
+    alignas(64) std::atomic<size_t> write_pos{0};
+    alignas(64) std::atomic<size_t> read_pos{0};
+};
@@ -0,0 +1,134 @@
+#include "state.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void capture(const Emu& emu, MachineState& out) {
+    out.pc = emu.pc;
+    out.i_reg = emu.i_reg;
+    out.sp = emu.sp;
+    out.dt = emu.dt;
+    out.st = emu.st;
+    std::copy(emu.v_reg, emu.v_reg + NUM_REGS, out.v_reg);
+    std::copy(emu.stack, emu.stack + STACK_SIZE, out.stack);
+    std::copy(emu.keys, emu.keys + NUM_KEYS, out.keys);
+    // 00FE and 00FF clear both resolutions, so the one not in use is all
+    // zero and only the other is copied. Likewise planes 1-3 only exist for
+    // XO-CHIP. What is skipped keeps its old contents in out.
+    out.hires = emu.hires;
+    if (emu.hires)
+        std::copy(emu.hires_screen, emu.hires_screen + HIRES_HEIGHT * HIRES_ROW_WORDS, out.hires_screen);
+    else
+        std::copy(emu.screen, emu.screen + SCREEN_HEIGHT, out.screen);
+    std::copy(emu.rpl, emu.rpl + NUM_REGS, out.rpl);
+    std::copy(emu.extra_planes.begin(), emu.extra_planes.end(), out.extra_planes);
+    out.plane_mask = emu.plane_mask;
+    std::copy(emu.audio_pattern, emu.audio_pattern + AUDIO_PATTERN_SIZE, out.audio_pattern);
+    out.pitch = emu.pitch;
+    out.rng = emu.rng;
+}
+
+void apply(const MachineState& state, Emu& emu) {
+    emu.pc = state.pc;
+    emu.i_reg = state.i_reg;
+    emu.sp = state.sp;
+    emu.dt = state.dt;
+    emu.st = state.st;
+    std::copy(state.v_reg, state.v_reg + NUM_REGS, emu.v_reg);
+    std::copy(state.stack, state.stack + STACK_SIZE, emu.stack);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        emu.keys[i] = state.keys[i] != 0;
+    }
+    // Only the resolution in use was captured. The other one has to end up
+    // zero, which it already is unless the Emu is in that resolution now.
+    bool hires = state.hires != 0;
+    if (hires) {
+        std::copy(state.hires_screen, state.hires_screen + HIRES_HEIGHT * HIRES_ROW_WORDS, emu.hires_screen);
+        if (!emu.hires)
+            std::fill(emu.screen, emu.screen + SCREEN_HEIGHT, 0);
+    } else {
+        std::copy(state.screen, state.screen + SCREEN_HEIGHT, emu.screen);
+        if (emu.hires)
+            std::fill(emu.hires_screen, emu.hires_screen + HIRES_HEIGHT * HIRES_ROW_WORDS, 0);
+    }
+    emu.hires = hires;
+    std::copy(state.rpl, state.rpl + NUM_REGS, emu.rpl);
+    // Planes only exist while the XO-CHIP profile is set
+    std::copy(state.extra_planes, state.extra_planes + emu.extra_planes.size(), emu.extra_planes.begin());
+    emu.plane_mask = state.plane_mask;
+    std::copy(state.audio_pattern, state.audio_pattern + AUDIO_PATTERN_SIZE, emu.audio_pattern);
+    emu.pitch = state.pitch;
+    emu.rng = state.rng;
+    emu.mark_display_dirty();
+}
+
+size_t state_size(const EmuState& state) {
+    return offsetof(EmuState, high_ram) + std::min<size_t>(state.high_ram_size, sizeof(state.high_ram));
+}
+
+void save_state(const Emu& emu, EmuState& out) {
+    // Padding included, so equal machines give equal blobs
+    std::memset(&out, 0, offsetof(EmuState, high_ram));
+    out.version = EMU_STATE_VERSION;
+    capture(emu, out.machine);
+    std::copy(emu.ram, emu.ram + RAM_SIZE, out.ram);
+    out.high_ram_size = uint32_t(emu.high_ram.size());
+    std::copy(emu.high_ram.begin(), emu.high_ram.end(), out.high_ram);
+}
+
+void load_state(const EmuState& state, Emu& emu) {
+    if (state.version != EMU_STATE_VERSION)
+        throw std::runtime_error("Save state version mismatch");
+    if (state.high_ram_size != emu.high_ram.size())
+        throw std::runtime_error("Save state is for a different quirk profile");
+    apply(state.machine, emu);
+    std::copy(state.ram, state.ram + RAM_SIZE, emu.ram);
+    std::copy(state.high_ram, state.high_ram + state.high_ram_size, emu.high_ram.begin());
+    emu.invalidate(0, emu.memory_size());
+}
+
+Snapshot Snapshotter::snapshot(Emu& emu) {
+    Snapshot snap;
+    snapshot(emu, snap);
+    return snap;
+}
+
+void Snapshotter::snapshot(Emu& emu, Snapshot& out) {
+    capture(emu, out.machine);
+    for (size_t page = 0; page < NUM_RAM_PAGES; ++page) {
+        if ((emu.dirty_pages >> page & 1) || !current[page]) {
+            auto copy = std::make_shared<RamPage>();
+            std::memcpy(copy->data(), emu.ram + page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+            current[page] = std::move(copy);
+        }
+        out.pages[page] = current[page];
+    }
+    if (emu.high_ram.empty()) {
+        current_high.reset();
+    } else if (emu.high_ram_dirty || !current_high) {
+        current_high = std::make_shared<std::vector<uint8_t>>(emu.high_ram);
+    }
+    out.high_ram = current_high;
+    emu.dirty_pages = 0;
+    emu.high_ram_dirty = false;
+}
+
+void Snapshotter::restore(Emu& emu, const Snapshot& snap) {
+    apply(snap.machine, emu);
+    for (size_t page = 0; page < NUM_RAM_PAGES; ++page) {
+        if (!(emu.dirty_pages >> page & 1) && current[page] == snap.pages[page])
+            continue;
+        std::memcpy(emu.ram + page * RAM_PAGE_SIZE, snap.pages[page]->data(), RAM_PAGE_SIZE);
+        emu.invalidate(page * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+        current[page] = snap.pages[page];
+    }
+    if (snap.high_ram && snap.high_ram->size() == emu.high_ram.size() &&
+        (emu.high_ram_dirty || current_high != snap.high_ram)) {
+        std::copy(snap.high_ram->begin(), snap.high_ram->end(), emu.high_ram.begin());
+        current_high = snap.high_ram;
+    }
+    // RAM now matches current[] page for page
+    emu.dirty_pages = 0;
+    emu.high_ram_dirty = false;
+}
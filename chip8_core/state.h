@@ -0,0 +1,85 @@
+#pragma once
+
+#include "core.h"
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump whenever the layout of MachineState or EmuState changes
+constexpr uint32_t EMU_STATE_VERSION = 5;
+
+// Everything in an Emu except RAM and the decode cache. Only the display of
+// the current resolution is captured, and XO-CHIP planes 1-3 only under that
+// profile; fields skipped keep what they held, which is zero in an EmuState.
+// XO-CHIP RAM above RAM_SIZE is not captured here, see EmuState.
+struct MachineState {
+    uint16_t pc;
+    uint16_t i_reg;
+    uint16_t sp;
+    uint8_t dt;
+    uint8_t st;
+    uint8_t v_reg[NUM_REGS];
+    uint16_t stack[STACK_SIZE];
+    uint8_t keys[NUM_KEYS];
+    uint64_t screen[SCREEN_HEIGHT];
+    uint8_t hires;
+    uint64_t hires_screen[HIRES_HEIGHT * HIRES_ROW_WORDS];
+    uint8_t rpl[NUM_REGS];
+    uint64_t extra_planes[(NUM_PLANES - 1) * PLANE_WORDS];
+    uint8_t plane_mask;
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    Rng rng;
+};
+
+// Flat, versioned copy of a whole machine, safe to memcpy or write to disk.
+// XO-CHIP RAM above RAM_SIZE ends it, prefixed with its size: 0 for other
+// profiles, whose states stop there (see state_size()). save_state() only
+// writes the first state_size() bytes; the rest of high_ram keeps what it held.
+struct EmuState {
+    uint32_t version;
+    MachineState machine;
+    uint8_t ram[RAM_SIZE];
+    uint32_t high_ram_size;
+    uint8_t high_ram[XO_RAM_SIZE - RAM_SIZE];
+};
+
+// Bytes from the start of state that it actually uses
+size_t state_size(const EmuState& state);
+
+void capture(const Emu& emu, MachineState& out);
+void apply(const MachineState& state, Emu& emu);
+
+void save_state(const Emu& emu, EmuState& out);
+// Throws if the blob was written by a different EMU_STATE_VERSION, or its
+// high RAM does not fit emu's profile
+void load_state(const EmuState& state, Emu& emu);
+
+using RamPage = std::array<uint8_t, RAM_PAGE_SIZE>;
+
+// A point-in-time copy of one Emu. RAM pages are shared with other snapshots
+// taken from the same Snapshotter until the ROM writes to them.
+struct Snapshot {
+    MachineState machine;
+    std::shared_ptr<const RamPage> pages[NUM_RAM_PAGES];
+    // XO-CHIP RAM above RAM_SIZE, null for other profiles
+    std::shared_ptr<const std::vector<uint8_t>> high_ram;
+};
+
+// Takes and restores snapshots of a single Emu. It remembers which shared
+// page matches each page of that Emu's RAM, so only pages flagged in
+// Emu::dirty_pages are copied. Use one Snapshotter per Emu.
+class Snapshotter {
+public:
+    Snapshot snapshot(Emu& emu);
+    void snapshot(Emu& emu, Snapshot& out);
+
+    void restore(Emu& emu, const Snapshot& snap);
+
+private:
+    std::shared_ptr<const RamPage> current[NUM_RAM_PAGES];
+    std::shared_ptr<const std::vector<uint8_t>> current_high;
+};
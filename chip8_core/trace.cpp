@@ -0,0 +1,38 @@
+#include "trace.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+Tracer::Tracer(const char* path) : file(std::fopen(path, "wb")), cycle(0), stopping(false) {
+    if (!file)
+        throw std::runtime_error("Could not open trace file");
+
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0 };
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    writer = std::thread(&Tracer::drain, this);
+}
+
+Tracer::~Tracer() {
+    stopping.store(true);
+    writer.join();
+    std::fclose(file);
+}
+
+void Tracer::drain() {
+    std::vector<TraceRecord> batch(4096);
+    while (true) {
+        // Read the flag first so nothing pushed before it was set is missed
+        bool last = stopping.load();
+        size_t count = ring.pop_many(batch.data(), batch.size());
+        if (count > 0) {
+            std::fwrite(batch.data(), sizeof(TraceRecord), count, file);
+            continue;
+        }
+        if (last)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::fflush(file);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "core.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+// Build with CHIP8_TRACE=1 to record every executed instruction. When it is 0
+// (the default) the hooks in Emu::dispatch are discarded at compile time.
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 0
+#endif
+
+constexpr bool TRACE_ENABLED = CHIP8_TRACE != 0;
+
+constexpr uint32_t TRACE_MAGIC = 0x52543843;  // "C8TR"
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr uint8_t TRACE_NO_REG = 0xFF;
+
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+// One executed instruction, as written to the trace file
+struct TraceRecord {
+    uint64_t cycle;
+    uint16_t pc;      // address the instruction was fetched from
+    uint16_t op;
+    uint16_t i_reg;   // I after the instruction
+    uint8_t reg;      // lowest V register it changed, or TRACE_NO_REG
+    uint8_t value;    // new value of that register
+};
+
+static_assert(sizeof(TraceRecord) == 16, "trace records are fixed size on disk");
+
+constexpr size_t TRACE_RING_SIZE = 1 << 16;
+
+// Collects records from one emulation thread and streams them to a file on a
+// background thread. Attach with emu.tracer = &tracer.
+class Tracer {
+public:
+    // Throws if the file cannot be created
+    explicit Tracer(const char* path);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void record(uint16_t pc, uint16_t op, uint16_t i_reg, const uint8_t* before, const uint8_t* after) {
+        TraceRecord rec;
+        rec.cycle = cycle++;
+        rec.pc = pc;
+        rec.op = op;
+        rec.i_reg = i_reg;
+        rec.reg = TRACE_NO_REG;
+        rec.value = 0;
+        for (uint8_t r = 0; r < NUM_REGS; ++r) {
+            if (before[r] != after[r]) {
+                rec.reg = r;
+                rec.value = after[r];
+                break;
+            }
+        }
+        // A trace with holes is useless, so wait for the writer rather than drop
+        while (!ring.try_push(rec)) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    void drain();
+
+    SpscRing<TraceRecord, TRACE_RING_SIZE> ring;
+    std::FILE* file;
+    uint64_t cycle;
+    std::atomic<bool> stopping;
+    std::thread writer;
+};
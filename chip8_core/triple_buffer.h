@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. The producer fills back() and publishes it; the consumer
+// picks up whichever value was published last, so a slow consumer skips
+// values instead of stalling the producer, and neither side ever waits.
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer: the slot to fill next, invisible to the consumer until publish()
+    T& back() {
+        return slots[back_index];
+    }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Consumer: swaps in the newest published value, false if nothing new
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() const {
+        return slots[front_index];
+    }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    T slots[3];
+    // Slot index in the low bits, FRESH once published and not yet acquired
+    alignas(64) std::atomic<uint8_t> middle{1};
+    alignas(64) uint8_t back_index = 0;   // producer only
+    alignas(64) uint8_t front_index = 2;  // consumer only
+};
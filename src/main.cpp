@@ -4,20 +4,46 @@
 #include <iostream>
 #include <SDL2/SDL.h>
 #include <fstream>
+#include <memory>
 
+#include "chip8_core/audio.h"
 #include "chip8_core/core.h"
+#include "chip8_core/rewind.h"
+#include "chip8_core/spsc_ring.h"
+#include "chip8_core/state.h"
+#include "chip8_core/trace.h"
+#include "chip8_core/triple_buffer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
 #include <vector>
 
 /*
+With CMake (the frontend is only built when SDL2 is found):
+cmake -S . -B build && cmake --build build
+
 For building for linux, use this in terminal (I used g++ compiler):
-g++ src/main.cpp src/tinyfiledialogs.cpp chip8_core/core.cpp -I. -o main `sdl2-config --cflags --libs`
+g++ src/main.cpp src/tinyfiledialogs.cpp chip8_core/core.cpp chip8_core/state.cpp chip8_core/rewind.cpp chip8_core/audio.cpp chip8_core/trace.cpp -I. -o main -pthread `sdl2-config --cflags --libs`
 
 Then run this:
 ./main
 
+To record every executed instruction for chip8_trace_dump, build the core
+with -DCHIP8_TRACE=ON (CHIP8_TRACE=1 for the line above) and run:
+./main --trace trace.bin
+
 For building for windows, the command is slightly longer. Use this:
 x86_64-w64-mingw32-g++ \
   src/main.cpp src/tinyfiledialogs.cpp chip8_core/core.cpp \
+  chip8_core/state.cpp chip8_core/rewind.cpp chip8_core/audio.cpp \
+  chip8_core/trace.cpp \
   -I. \
   -I ~/Projects/SDL2-2.32.6/x86_64-w64-mingw32/include \
   -L ~/Projects/SDL2-2.32.6/x86_64-w64-mingw32/lib \
@@ -25,32 +51,319 @@ x86_64-w64-mingw32-g++ \
   -lmingw32 -lSDL2 -lole32 -mwindows
 */
 
-const uint32_t SCALE = 15;
+// Even, so SUPER-CHIP high resolution scales by a whole number too
+const uint32_t SCALE = 16;
 const uint32_t WINDOW_WIDTH = SCREEN_WIDTH * SCALE;
 const uint32_t WINDOW_HEIGHT = SCREEN_HEIGHT * SCALE;
-const size_t TICKS_PER_FRAME = 10;
+const size_t REWIND_BUFFER_BYTES = 8 * 1024 * 1024;
+// F2 cycles the run-ahead depth through 0..MAX_RUN_AHEAD frames
+const size_t MAX_RUN_AHEAD = 4;
 
-void draw_screen(Emu& emu, SDL_Renderer* renderer){
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+const uint32_t COLOR_ON = 0xFFFFFFFF;
+const uint32_t COLOR_OFF = 0xFF000000;
 
-    const bool* screen_buf = emu.get_display();
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+// Branch-free so the compiler can vectorize it. Each bit of the word fills
+// `repeat` texels.
+template <size_t repeat>
+void expand_word(uint64_t word, uint32_t* out){
+    for (size_t x = 0; x < 64 * repeat; ++x) {
+        uint32_t lit = 0u - uint32_t((word >> (63 - x / repeat)) & 1);
+        out[x] = (COLOR_ON & lit) | (COLOR_OFF & ~lit);
+    }
+}
+
+// XO-CHIP colors, indexed by the plane bits of a pixel (plane 0 is bit 0)
+const uint32_t PALETTE[1 << NUM_PLANES] = {
+    0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555,
+    0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFF00,
+    0xFF880000, 0xFF008800, 0xFF000088, 0xFF888800,
+    0xFFFF00FF, 0xFF00FFFF, 0xFF880088, 0xFF008888,
+};
+
+// One display as the emulation thread published it. The render thread only
+// ever sees these copies, never the Emu.
+struct Frame {
+    uint64_t seq;    // publish count, a gap means the renderer skipped frames
+    uint64_t dirty;  // rows changed since the previous published frame
+    bool hires;
+    size_t num_planes;
+    uint64_t planes[NUM_PLANES][PLANE_WORDS];
+    // Emulation thread time spent on this frame: the real frame, then the
+    // speculative run_ahead frames including the snapshot and restore
+    float emu_ms;
+    float ahead_ms;
+    uint8_t run_ahead;
 
-    for (size_t i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i) {
-        bool pixel = screen_buf[i];
-        if (pixel){
-            uint32_t x = i % SCREEN_WIDTH;
-            uint32_t y = i / SCREEN_WIDTH;
-            SDL_Rect rect;
-            rect.x = x * SCALE;
-            rect.y = y * SCALE;
-            rect.w = SCALE;
-            rect.h = SCALE;
-            SDL_RenderFillRect(renderer, &rect);
+    size_t height() const { return hires ? HIRES_HEIGHT : SCREEN_HEIGHT; }
+    size_t row_words() const { return hires ? HIRES_ROW_WORDS : 1; }
+};
+
+void capture_frame(const Emu& emu, Frame& out){
+    out.hires = emu.hires;
+    out.num_planes = emu.num_planes();
+    size_t words = out.height() * out.row_words();
+    for (size_t p = 0; p < out.num_planes; ++p) {
+        std::copy(emu.get_plane(p), emu.get_plane(p) + words, out.planes[p]);
+    }
+}
+
+// Slower than expand_word, only used while more than one plane exists
+void expand_colors(const Frame& frame, size_t y, uint32_t* out, size_t repeat){
+    size_t words = frame.row_words();
+    for (size_t x = 0; x < 64 * words; ++x) {
+        size_t at = y * words + x / 64;
+        unsigned shift = 63 - x % 64;
+        uint8_t color = 0;
+        for (size_t p = 0; p < frame.num_planes; ++p) {
+            color |= ((frame.planes[p][at] >> shift) & 1) << p;
         }
+        std::fill(out + x * repeat, out + (x + 1) * repeat, PALETTE[color]);
     }
-    SDL_RenderPresent(renderer);
+}
+
+// CPU-side copy of the texture, only dirty rows are re-expanded and uploaded.
+// The texture is always high resolution; low resolution pixels are doubled.
+uint32_t framebuffer[HIRES_WIDTH * HIRES_HEIGHT];
+
+void upload_frame(const Frame& frame, uint64_t dirty, SDL_Texture* texture){
+    const uint64_t* rows = frame.planes[0];
+    // Texture rows per display row
+    int tall = frame.hires ? 1 : 2;
+    int first = -1;
+    int last = -1;
+    for (size_t y = 0; y < frame.height(); ++y) {
+        if (!(dirty & (uint64_t(1) << y)))
+            continue;
+        uint32_t* out = &framebuffer[y * tall * HIRES_WIDTH];
+        if (frame.num_planes > 1) {
+            expand_colors(frame, y, out, frame.hires ? 1 : 2);
+            if (!frame.hires)
+                std::copy(out, out + HIRES_WIDTH, out + HIRES_WIDTH);
+        } else if (frame.hires) {
+            for (size_t w = 0; w < HIRES_ROW_WORDS; ++w) {
+                expand_word<1>(rows[y * HIRES_ROW_WORDS + w], out + 64 * w);
+            }
+        } else {
+            expand_word<2>(rows[y], out);
+            std::copy(out, out + HIRES_WIDTH, out + HIRES_WIDTH);
+        }
+        if (first < 0) first = y * tall;
+        last = y * tall + tall - 1;
+    }
+    if (first < 0)
+        return;
+    SDL_Rect span = { 0, first, int(HIRES_WIDTH), last - first + 1 };
+    SDL_UpdateTexture(texture, &span, &framebuffer[first * HIRES_WIDTH], HIRES_WIDTH * sizeof(uint32_t));
+}
+
+// Samples from the emulation loop (producer) to SDL's audio thread (consumer)
+AudioRing audio_ring;
+
+// Runs on SDL's audio thread. Never waits: whatever the emulator has not
+// produced yet is played as silence.
+void audio_callback(void* user, Uint8* stream, int len){
+    AudioRing* ring = static_cast<AudioRing*>(user);
+    int16_t* out = reinterpret_cast<int16_t*>(stream);
+    size_t count = size_t(len) / sizeof(int16_t);
+    size_t got = ring->pop_many(out, count);
+    std::fill(out + got, out + count, 0);
+}
+
+using Clock = std::chrono::steady_clock;
+
+// 1/60 s, rounded; the 0.3 ns a frame it is off by never adds up to anything audible
+const Clock::duration FRAME_PERIOD = std::chrono::nanoseconds(16666667);
+
+// Further behind than this (a debugger stop, a suspended laptop) and the
+// emulation thread restarts its clock instead of racing to catch up
+const Clock::duration MAX_LAG = 4 * FRAME_PERIOD;
+
+// sleep_until alone can overshoot by a whole scheduler quantum, so sleep
+// most of the way and yield through the rest
+void wait_until(Clock::time_point deadline){
+    const Clock::duration slack = std::chrono::milliseconds(2);
+    if (deadline - Clock::now() > slack)
+        std::this_thread::sleep_until(deadline - slack);
+    while (Clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+enum class InputKind : uint8_t { Key, Rewind, CycleRunAhead };
+
+struct InputEvent {
+    Clock::time_point time;  // when the event pump saw it
+    InputKind kind;
+    uint8_t key;
+    bool pressed;
+};
+
+// What the event pump and renderer (main thread) share with the emulation
+// thread. Each queue has exactly one producer and one consumer.
+struct Shared {
+    SpscRing<InputEvent, 256> input;  // main thread -> emulation
+    TripleBuffer<Frame> frames;       // emulation -> main thread
+    std::atomic<bool> running{true};
+};
+
+// Owns the Emu once started. Runs one frame per FRAME_PERIOD on its own clock,
+// so neither the display's refresh rate nor a slow present changes the speed.
+void emulation_thread(Emu& chip8, Shared& shared, bool audio){
+    RewindBuffer history(REWIND_BUFFER_BYTES);
+    AudioSynth synth;
+    std::deque<InputEvent> pending;
+    bool rewinding = false;
+    bool halted = false;
+    uint64_t published = 0;
+    Snapshotter snapshotter;
+    Snapshot ahead;
+    size_t run_ahead = 0;
+
+    Clock::time_point next = Clock::now();
+    while (shared.running.load(std::memory_order_relaxed)) {
+        wait_until(next);
+
+        // Everything that happened before this frame was due goes into it,
+        // in order; later events wait for the next frame
+        InputEvent evt;
+        while (shared.input.try_pop(evt)) {
+            pending.push_back(evt);
+        }
+        while (!pending.empty() && pending.front().time <= next) {
+            const InputEvent& in = pending.front();
+            if (in.kind == InputKind::Rewind)
+                rewinding = in.pressed;
+            else if (in.kind == InputKind::CycleRunAhead)
+                run_ahead = (run_ahead + 1) % (MAX_RUN_AHEAD + 1);
+            else
+                chip8.keypress(in.key, in.pressed);
+            pending.pop_front();
+        }
+
+        Clock::time_point start = Clock::now();
+        if (rewinding) {
+            // Hold Backspace to run backwards, one frame per frame.
+            // Keys come from the keyboard as it is now, not from history.
+            bool held[NUM_KEYS];
+            std::copy(chip8.keys, chip8.keys + NUM_KEYS, held);
+            history.rewind(chip8, 1);
+            std::copy(held, held + NUM_KEYS, chip8.keys);
+        } else {
+            // The frame's sound comes from ST as the frame starts, like in the headless runner
+            if (audio)
+                synth.render_frame(chip8, audio_ring);
+            // Emulation steps, skipped while the ROM is only waiting on DT or a key
+            if (chip8.fast_forward(1) == 0) {
+                Status status = chip8.run_frame().status;
+                // The ROM stays frozen on the bad opcode; rewinding still works
+                if (status == Status::Halted && !halted) {
+                    std::cerr << "Halted on unknown opcode 0x" << std::hex << chip8.fetch()
+                              << " at 0x" << chip8.pc << std::dec << "\n";
+                }
+                halted = status == Status::Halted;
+            }
+            history.push(chip8);
+        }
+
+        Clock::time_point real_end = Clock::now();
+
+        // Published every frame, changed or not, so the overlay keeps moving
+        Frame& frame = shared.frames.back();
+        frame.dirty = chip8.take_dirty_rows();
+        if (run_ahead > 0 && !rewinding) {
+            // Run-ahead: show where the ROM will be run_ahead frames from now
+            // if the keys stay as they are, then put the real state back. A
+            // keypress shows up that many frames sooner. No sound, no history.
+            // The speculative frames are thrown away, so they stay out of the trace.
+            snapshotter.snapshot(chip8, ahead);
+            Tracer* tracer = chip8.tracer;
+            chip8.tracer = nullptr;
+            for (size_t i = 0; i < run_ahead; ++i) {
+                if (chip8.fast_forward(1) == 0)
+                    chip8.run_frame();
+            }
+            chip8.tracer = tracer;
+            capture_frame(chip8, frame);
+            snapshotter.restore(chip8, ahead);
+            // Neither the speculative rows nor the restored ones are known to the renderer
+            chip8.take_dirty_rows();
+            frame.dirty = ~uint64_t(0);
+        } else {
+            capture_frame(chip8, frame);
+        }
+        Clock::time_point end = Clock::now();
+        frame.emu_ms = std::chrono::duration<float, std::milli>(real_end - start).count();
+        frame.ahead_ms = std::chrono::duration<float, std::milli>(end - real_end).count();
+        frame.run_ahead = uint8_t(rewinding ? 0 : run_ahead);
+        frame.seq = ++published;
+        shared.frames.publish();
+
+        next += FRAME_PERIOD;
+        if (Clock::now() - next > MAX_LAG)
+            next = Clock::now();
+    }
+}
+
+// Main thread side of the input queue. The emulation thread drains it every
+// frame, so it only fills up if that thread is gone.
+void send_input(Shared& shared, InputKind kind, int key, bool pressed){
+    InputEvent evt = { Clock::now(), kind, uint8_t(key), pressed };
+    while (!shared.input.try_push(evt) && shared.running.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+}
+
+// F1 overlay: one bar per published frame, real frame time in green with the
+// run-ahead overhead stacked on top in red, against a line at the 60 Hz budget
+const size_t OVERLAY_FRAMES = 120;
+const int OVERLAY_BAR_WIDTH = 4;
+const float OVERLAY_PX_PER_MS = 8.0f;
+
+struct FrameTimes {
+    float emu_ms[OVERLAY_FRAMES] = {};
+    float ahead_ms[OVERLAY_FRAMES] = {};
+    size_t next = 0;
+
+    void add(const Frame& frame) {
+        emu_ms[next] = frame.emu_ms;
+        ahead_ms[next] = frame.ahead_ms;
+        next = (next + 1) % OVERLAY_FRAMES;
+    }
+};
+
+void draw_overlay(const FrameTimes& times, SDL_Renderer* renderer){
+    int base = int(WINDOW_HEIGHT) - 1;
+    for (size_t i = 0; i < OVERLAY_FRAMES; ++i) {
+        size_t at = (times.next + i) % OVERLAY_FRAMES;
+        int x = int(i) * OVERLAY_BAR_WIDTH;
+        int real = std::max(1, int(times.emu_ms[at] * OVERLAY_PX_PER_MS));
+        int extra = int(times.ahead_ms[at] * OVERLAY_PX_PER_MS);
+        SDL_Rect real_bar = { x, base - real, OVERLAY_BAR_WIDTH - 1, real };
+        SDL_SetRenderDrawColor(renderer, 0, 200, 0, 255);
+        SDL_RenderFillRect(renderer, &real_bar);
+        if (extra > 0) {
+            SDL_Rect extra_bar = { x, base - real - extra, OVERLAY_BAR_WIDTH - 1, extra };
+            SDL_SetRenderDrawColor(renderer, 220, 0, 0, 255);
+            SDL_RenderFillRect(renderer, &extra_bar);
+        }
+    }
+    int budget = base - int(1000.0f / 60.0f * OVERLAY_PX_PER_MS);
+    SDL_Rect line = { 0, budget, int(OVERLAY_FRAMES) * OVERLAY_BAR_WIDTH, 1 };
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &line);
+}
+
+// There is no font to draw with, so the numbers go in the title bar
+void show_frame_stats(const FrameTimes& times, const Frame& frame, SDL_Window* window){
+    float emu = 0.0f;
+    float extra = 0.0f;
+    for (size_t i = 0; i < OVERLAY_FRAMES; ++i) {
+        emu += times.emu_ms[i];
+        extra += times.ahead_ms[i];
+    }
+    char title[128];
+    std::snprintf(title, sizeof(title), "Chip-8 Emulator - frame %.3f ms, run-ahead %u: +%.3f ms",
+                  emu / OVERLAY_FRAMES, unsigned(frame.run_ahead), extra / OVERLAY_FRAMES);
+    SDL_SetWindowTitle(window, title);
 }
 
 int key2btn(SDL_Keycode key) {
@@ -75,14 +388,28 @@ int key2btn(SDL_Keycode key) {
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    const char* trace_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--trace FILE]\n";
+            return 1;
+        }
+    }
+    if (trace_path && !TRACE_ENABLED) {
+        std::cerr << "--trace needs chip8_core built with -DCHIP8_TRACE=ON\n";
+        return 1;
+    }
+
     // Optional: file filters (NULL or empty means all files)
-    const char* filters[] = { "*.ch8" };
+    const char* filters[] = { "*.ch8", "*.sc8", "*.xo8" };
 
     const char* path = tinyfd_openFileDialog(
         "Select a file",   // Dialog title
         "",                // Default path (empty for none)
-        1,                 // Number of filter patterns
+        3,                 // Number of filter patterns
         filters,           // Filter patterns
         "Chip8 ROMs",// Description of filters
         0                  // Allow multiple selections? (0 = no)
@@ -94,7 +421,7 @@ int main() {
         std::cout << "No file selected." << std::endl;
     }
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
         std::cerr << "SDL_Init Error: " << SDL_GetError() << "\n";
         return 1;
     }
@@ -128,6 +455,38 @@ int main() {
         return 1;
     }
 
+    // The framebuffer is uploaded at high resolution and scaled on the GPU
+    SDL_Texture* texture = SDL_CreateTexture(
+        renderer,
+        SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING,
+        HIRES_WIDTH,
+        HIRES_HEIGHT
+    );
+
+    if (!texture) {
+        std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << "\n";
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 1;
+    }
+
+    // Mono 16-bit at the synth's rate, so samples go to the device untouched.
+    // Without a device the emulator still runs, just silently.
+    SDL_AudioSpec want = {};
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 512;
+    want.callback = audio_callback;
+    want.userdata = &audio_ring;
+    SDL_AudioDeviceID audio = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0);
+    if (audio == 0)
+        std::cerr << "SDL_OpenAudioDevice Error: " << SDL_GetError() << "\n";
+    else
+        SDL_PauseAudioDevice(audio, 0);
+
     // Clear the screen to black
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
@@ -138,6 +497,7 @@ int main() {
     std::ifstream rom(path, std::ios::binary);
     if (!rom.is_open()) {
         std::cerr << "Did not find file: " << path << "\n";
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
@@ -149,47 +509,97 @@ int main() {
         std::istreambuf_iterator<char>()
     );
 
+    // XO-CHIP ROMs need the 64 KB address space before they are loaded
+    chip8.set_quirks(profile_for(path));
     chip8.load(buffer.data(), buffer.size());
 
-    bool running = true;
+    // Records from the emulation thread; outlives it, so the file is complete
+    std::unique_ptr<Tracer> tracer;
+    if (trace_path) {
+        try {
+            tracer = std::make_unique<Tracer>(trace_path);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            SDL_DestroyTexture(texture);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return 1;
+        }
+        chip8.tracer = tracer.get();
+    }
+
+    // Large (three frames plus the rings), so not on the stack
+    std::unique_ptr<Shared> shared = std::make_unique<Shared>();
+    std::thread emulation(emulation_thread, std::ref(chip8), std::ref(*shared), audio != 0);
+
+    // This thread keeps the event pump and the renderer, which SDL requires to
+    // stay on the thread that created the window. VSync now only paces them.
+    uint64_t shown = 0;
+    bool overlay = false;
+    FrameTimes times;
     SDL_Event evt;
 
-    while (running) {
+    while (shared->running.load(std::memory_order_relaxed)) {
         // Event pump
         while (SDL_PollEvent(&evt)) {
             switch (evt.type) {
                 case SDL_QUIT:
-                    running = false;
+                    shared->running.store(false);
                     break;
 
                 case SDL_KEYDOWN:
+                    // A held key sends repeats: the toggles and the rewind
+                    // hold only want the first press
                     if (evt.key.keysym.sym == SDLK_ESCAPE) {
-                        running = false;
+                        shared->running.store(false);
+                    } else if (evt.key.keysym.sym == SDLK_F1) {
+                        if (!evt.key.repeat) {
+                            overlay = !overlay;
+                            if (!overlay)
+                                SDL_SetWindowTitle(window, "Chip-8 Emulator");
+                        }
+                    } else if (evt.key.keysym.sym == SDLK_F2) {
+                        if (!evt.key.repeat)
+                            send_input(*shared, InputKind::CycleRunAhead, 0, true);
+                    } else if (evt.key.keysym.sym == SDLK_BACKSPACE) {
+                        if (!evt.key.repeat)
+                            send_input(*shared, InputKind::Rewind, 0, true);
                     } else {
                         int k = key2btn(evt.key.keysym.sym);
-                        if (k != -1) chip8.keypress(k, true);
+                        if (k != -1) send_input(*shared, InputKind::Key, k, true);
                     }
                     break;
 
                 case SDL_KEYUP:
-                    {
+                    if (evt.key.keysym.sym == SDLK_BACKSPACE) {
+                        send_input(*shared, InputKind::Rewind, 0, false);
+                    } else {
                         int k = key2btn(evt.key.keysym.sym);
-                        if (k != -1) chip8.keypress(k, false);
+                        if (k != -1) send_input(*shared, InputKind::Key, k, false);
                     }
                     break;
             }
         }
 
-        // Emulation steps
-        for (int i = 0; i < TICKS_PER_FRAME; i++) {
-            chip8.tick();
+        // Drawing. Only the newest frame is uploaded; if any were skipped their
+        // dirty rows are unknown, so the whole display is redrawn.
+        if (shared->frames.acquire()) {
+            const Frame& frame = shared->frames.front();
+            upload_frame(frame, frame.seq == shown + 1 ? frame.dirty : ~uint64_t(0), texture);
+            shown = frame.seq;
+            times.add(frame);
+            if (overlay && times.next == 0)
+                show_frame_stats(times, frame, window);
         }
-        chip8.tick_timers();
-
-        // Drawing
-        draw_screen(chip8, renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        if (overlay)
+            draw_overlay(times, renderer);
+        SDL_RenderPresent(renderer);
     }
 
-    
+    emulation.join();
+    if (audio != 0)
+        SDL_CloseAudioDevice(audio);
     return 0;
 }
\ No newline at end of file
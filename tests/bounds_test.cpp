@@ -0,0 +1,124 @@
+#include "test_util.h"
+
+#include <algorithm>
+#include <random>
+
+/*
+Out-of-range accesses a ROM can ask for: I past the end of RAM, calls and
+returns past either end of the stack, key numbers above 0xF. Each has to
+stay inside the Emu, the stack ones as traps. Then random ROMs are run
+under every profile to check that no state goes out of range.
+
+Usage:
+./chip8_test_bounds [rom.ch8]...
+*/
+
+constexpr size_t FUZZ_ROMS = 200;
+constexpr size_t FUZZ_FRAMES = 100;
+
+// AFFF, 6F07, FF1E, 60FF, FF55: I = 0x1006, then V0-VF stored there
+const uint8_t STORE_PAST_RAM[] = {
+    0xAF, 0xFF, 0x6F, 0x07, 0xFF, 0x1E, 0x60, 0xFF, 0xFF, 0x55,
+};
+
+// 2200: calls itself until the stack is full
+const uint8_t CALL_SELF[] = {
+    0x22, 0x00,
+};
+
+// 00EE with nothing on the stack
+const uint8_t RET_EMPTY[] = {
+    0x00, 0xEE,
+};
+
+// 6010, E09E: key 0x10 is key 0, which is held, so the skip is taken
+const uint8_t SKIP_KEY_16[] = {
+    0x60, 0x10, 0xE0, 0x9E,
+};
+
+static void check_store_past_ram(TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom_of(STORE_PAST_RAM), QuirkProfile::Default);
+    for (int i = 0; i < 5; ++i) {
+        emu->tick();
+    }
+    bool blank = std::all_of(emu->screen, emu->screen + SCREEN_HEIGHT, [](uint64_t row) { return row == 0; });
+    if (!blank || emu->display_gen != 0 || emu->ram[0x006] != 0xFF || emu->ram[0x015] != 0x07)
+        run.fail("store past RAM", "FX55 did not wrap to the start of RAM", 0);
+    else
+        run.pass("store past RAM", "FX55 wraps to the start of RAM");
+}
+
+static void check_call_self(TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom_of(CALL_SELF), QuirkProfile::Default);
+    RunResult frame = emu->run_frame();
+    RunResult again = emu->run_frame();
+    if (frame.status != Status::Ok || again.status != Status::Halted || emu->sp != STACK_SIZE
+        || emu->pc != START_ADDR || emu->dt != 0 || std::any_of(emu->keys, emu->keys + NUM_KEYS, [](bool k) { return k; }))
+        run.fail("call self", "a full stack did not halt on the next 2NNN", 1);
+    else
+        run.pass("call self", "a full stack halts on the next 2NNN");
+}
+
+static void check_ret_empty(TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom_of(RET_EMPTY), QuirkProfile::Default);
+    Status halted = emu->tick();
+    emu->set_trap_policy(TrapPolicy::Skip);
+    Status skipped = emu->tick();
+    if (halted != Status::Halted || skipped != Status::Trapped || emu->sp != 0 || emu->pc != START_ADDR + 2)
+        run.fail("return empty", "00EE on an empty stack did not trap", 0);
+    else
+        run.pass("return empty", "00EE on an empty stack traps");
+}
+
+static void check_skip_key_16(TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom_of(SKIP_KEY_16), QuirkProfile::Default);
+    emu->keypress(0, true);
+    emu->tick();
+    emu->tick();
+    if (emu->pc != START_ADDR + 6)
+        run.fail("key 0x10", "EX9E did not read key 0", 0);
+    else
+        run.pass("key 0x10", "EX9E reads the low nibble of Vx");
+}
+
+static void fuzz(const std::string& name, const std::vector<uint8_t>& rom, QuirkProfile profile, TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom, profile);
+    emu->set_trap_policy(TrapPolicy::Skip);
+    for (size_t frame = 0; frame < FUZZ_FRAMES; ++frame) {
+        emu->keypress(frame % NUM_KEYS, frame % 3 == 0);
+        emu->run_frame();
+        if (emu->sp > STACK_SIZE) {
+            run.fail(name, "sp is past the stack", frame);
+            return;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    TestRun run;
+    check_store_past_ram(run);
+    check_call_self(run);
+    check_ret_empty(run);
+    check_skip_key_16(run);
+
+    std::mt19937 gen(8);
+    size_t failures = run.failures;
+    for (size_t i = 0; i < FUZZ_ROMS; ++i) {
+        std::vector<uint8_t> rom(RAM_SIZE - START_ADDR);
+        for (uint8_t& byte : rom) {
+            byte = uint8_t(gen());
+        }
+        for (size_t p = 0; p < size_t(QuirkProfile::Count); ++p) {
+            fuzz("random ROM " + std::to_string(i), rom, QuirkProfile(p), run);
+        }
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> rom = read_rom(argv[i]);
+        for (size_t p = 0; p < size_t(QuirkProfile::Count); ++p) {
+            fuzz(argv[i], rom, QuirkProfile(p), run);
+        }
+    }
+    if (run.failures == failures)
+        run.pass("random ROMs", "every profile stays in range");
+    return run.failures > 0;
+}
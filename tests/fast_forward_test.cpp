@@ -0,0 +1,83 @@
+#include "test_util.h"
+
+/*
+Emu::fast_forward against run_frame: one machine runs every frame, the
+other skips wait loops wherever fast_forward allows, and the two are
+compared each time the skipping one lands on a frame.
+
+Runs the ROMs given plus built-in programs for each kind of wait: a delay
+timer loop, FX0A with a key pressed later on, and a jump to itself.
+
+Usage:
+./chip8_test_fast_forward <rom.ch8>...
+*/
+
+constexpr size_t FRAMES = 3000;
+constexpr size_t KEY_FRAME = 1234;  // when the key for FX0A goes down
+
+// 6X1D, F015, F107, 3100, 1204, 7201, 1200: waits 29 frames per round
+const uint8_t TIMER_LOOP[] = {
+    0x60, 0x1D, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x00, 0x12, 0x04, 0x72, 0x01, 0x12, 0x00,
+};
+
+// 6020, F018, F30A, 1204: sets ST, then waits for a key twice
+const uint8_t KEY_WAIT[] = {
+    0x60, 0x20, 0xF0, 0x18, 0xF3, 0x0A, 0x12, 0x04,
+};
+
+// 6005, F015, 1204: DT runs out while the ROM spins on its last jump
+const uint8_t SELF_JUMP[] = {
+    0x60, 0x05, 0xF0, 0x15, 0x12, 0x04,
+};
+
+static void check_rom(const std::string& name, const std::vector<uint8_t>& rom, QuirkProfile profile,
+                      TestRun& run) {
+    std::unique_ptr<Emu> reference = make_emu(rom, profile);
+    std::unique_ptr<Emu> emu = make_emu(rom, profile);
+
+    size_t done = 0;  // frames the reference has run
+    size_t frame = 0;
+    size_t skipped = 0;
+    while (frame < FRAMES) {
+        if (frame == KEY_FRAME)
+            emu->keypress(0x7, true);
+        // Like chip8_headless, never skip past a scheduled input
+        size_t until = frame < KEY_FRAME ? KEY_FRAME : FRAMES;
+        size_t step = emu->fast_forward(until - frame);
+        if (step == 0) {
+            emu->run_frame();
+            step = 1;
+        } else {
+            skipped += step;
+        }
+        frame += step;
+
+        for (; done < frame; ++done) {
+            if (done == KEY_FRAME)
+                reference->keypress(0x7, true);
+            reference->run_frame();
+        }
+        if (!same_state(*reference, *emu)) {
+            run.fail(name, "fast_forward differs from running the frames", frame);
+            return;
+        }
+    }
+    std::string what = "fast_forward matches run_frame, " + std::to_string(skipped) + " frames skipped";
+    run.pass(name, what.c_str());
+}
+
+int main(int argc, char** argv) {
+    TestRun run;
+    check_rom("timer loop", rom_of(TIMER_LOOP), QuirkProfile::Default, run);
+    check_rom("key wait", rom_of(KEY_WAIT), QuirkProfile::Default, run);
+    check_rom("self jump", rom_of(SELF_JUMP), QuirkProfile::Default, run);
+    for (int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> rom = read_rom(argv[i]);
+        if (rom.empty()) {
+            run.fail(argv[i], "cannot load ROM", 0);
+            continue;
+        }
+        check_rom(argv[i], rom, profile_for(argv[i]), run);
+    }
+    return run.failures > 0;
+}
@@ -0,0 +1,59 @@
+#include "chip8_core/rewind.h"
+#include "test_util.h"
+
+/*
+RewindBuffer against full save_state() copies of every frame pushed: it is
+stepped back in uneven strides until the history runs out, and each state
+it lands on has to match the copy taken when that frame was pushed.
+
+Runs the ROMs given plus the same built-in programs as chip8_test_state,
+so resolution changes and XO-CHIP high RAM go through the deltas too.
+
+Usage:
+./chip8_test_rewind <rom.ch8>...
+*/
+
+constexpr size_t FRAMES = 600;
+constexpr size_t REWIND_BYTES = 4 * 1024 * 1024;
+
+static void check_rom(const std::string& name, const std::vector<uint8_t>& rom, QuirkProfile profile,
+                      TestRun& run) {
+    std::unique_ptr<Emu> emu = make_emu(rom, profile);
+    RewindBuffer history(REWIND_BYTES);
+    std::vector<std::unique_ptr<EmuState>> pushed;
+
+    for (size_t frame = 0; frame < FRAMES; ++frame) {
+        emu->run_frame();
+        history.push(*emu);
+        pushed.push_back(std::make_unique<EmuState>());
+        save_state(*emu, *pushed.back());
+    }
+
+    for (size_t step = 1; history.frames() > 0; step = step % 7 + 1) {
+        size_t rewound = history.rewind(*emu, step);
+        pushed.resize(pushed.size() - rewound);
+        std::unique_ptr<Emu> expected = std::make_unique<Emu>();
+        expected->set_quirks(profile);
+        load_state(*pushed.back(), *expected);
+        if (!same_state(*expected, *emu)) {
+            run.fail(name, "rewound state differs from the one pushed", pushed.size() - 1);
+            return;
+        }
+    }
+    run.pass(name, "rewind round trip");
+}
+
+int main(int argc, char** argv) {
+    TestRun run;
+    check_rom("resolution flips", rom_of(RESOLUTION_FLIPS), QuirkProfile::SuperChip, run);
+    check_rom("high RAM counter", rom_of(HIGH_RAM_COUNTER), QuirkProfile::XoChip, run);
+    for (int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> rom = read_rom(argv[i]);
+        if (rom.empty()) {
+            run.fail(argv[i], "cannot load ROM", 0);
+            continue;
+        }
+        check_rom(argv[i], rom, profile_for(argv[i]), run);
+    }
+    return run.failures > 0;
+}
@@ -0,0 +1,81 @@
+#include "test_util.h"
+
+/*
+Emu::run_frame against TICKS_PER_FRAME tick()s and tick_timers(): run_frame
+skips the rest of a frame once the ROM waits, which must never change the
+outcome. Besides the ROMs given, built-in programs cover waits it may skip
+and instructions that leave pc in place but are not waits.
+
+Usage:
+./chip8_test_run_frame <rom.ch8>...
+*/
+
+constexpr size_t FRAMES = 1000;
+
+// 2202, 00EE: the return lands on itself, the next one underflows the stack
+const uint8_t RET_TO_SELF[] = {
+    0x22, 0x02, 0x00, 0xEE,
+};
+
+// F000, 1200: F000 is XO-CHIP, so the default profile traps on it, into a
+// hook that counts in V1 and leaves pc where it is
+const uint8_t HOOKED_TRAP[] = {
+    0xF0, 0x00, 0x12, 0x00,
+};
+
+// F00A, 7101, 1200: waits for a key, counts presses in V1
+const uint8_t KEY_WAIT[] = {
+    0xF0, 0x0A, 0x71, 0x01, 0x12, 0x00,
+};
+
+static Status count_trap(Emu& emu, uint16_t /*op*/, void* /*user*/) {
+    emu.v_reg[1]++;
+    return Status::Ok;
+}
+
+static void check_rom(const std::string& name, const std::vector<uint8_t>& rom, QuirkProfile profile,
+                      TestRun& run, TrapHook hook = nullptr) {
+    std::unique_ptr<Emu> reference = make_emu(rom, profile);
+    std::unique_ptr<Emu> emu = make_emu(rom, profile);
+    if (hook) {
+        reference->set_trap_policy(TrapPolicy::Hook, hook);
+        emu->set_trap_policy(TrapPolicy::Hook, hook);
+    }
+
+    for (size_t frame = 0; frame < FRAMES; ++frame) {
+        bool pressed = frame % 50 < 5;
+        reference->keypress(3, pressed);
+        emu->keypress(3, pressed);
+
+        Status expected = Status::Ok;
+        for (size_t t = 0; t < TICKS_PER_FRAME && expected != Status::Halted; ++t) {
+            Status status = reference->tick();
+            if (status != Status::Ok)
+                expected = status;
+        }
+        reference->tick_timers();
+        RunResult result = emu->run_frame();
+
+        if (result.status != expected || !same_state(*reference, *emu)) {
+            run.fail(name, "run_frame differs from ticking the frame", frame);
+            return;
+        }
+    }
+    run.pass(name, "run_frame matches tick()");
+}
+
+int main(int argc, char** argv) {
+    TestRun run;
+    check_rom("return to itself", rom_of(RET_TO_SELF), QuirkProfile::Default, run);
+    check_rom("hooked trap", rom_of(HOOKED_TRAP), QuirkProfile::Default, run, count_trap);
+    check_rom("key wait", rom_of(KEY_WAIT), QuirkProfile::Default, run);
+    for (int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> rom = read_rom(argv[i]);
+        if (rom.empty()) {
+            run.fail(argv[i], "cannot load ROM", 0);
+            continue;
+        }
+        check_rom(argv[i], rom, profile_for(argv[i]), run);
+    }
+    return run.failures > 0;
+}
@@ -0,0 +1,69 @@
+#include "test_util.h"
+
+/*
+Round trips through the state code, compared with save_state():
+- save_state then load_state into a fresh Emu gives the same machine
+- a Snapshot restored after running ahead puts the machine back exactly,
+  as the frontend's run-ahead does every frame
+
+Runs the ROMs given plus two built-in programs, one flipping between the
+SUPER-CHIP resolutions and one writing XO-CHIP RAM above 4 KB.
+
+Usage:
+./chip8_test_state <rom.ch8>...
+*/
+
+constexpr size_t FRAMES = 600;
+constexpr size_t RUN_AHEAD = 3;
+
+static void check_save_load(const std::string& name, const Emu& emu, size_t frame, TestRun& run) {
+    std::unique_ptr<EmuState> state = std::make_unique<EmuState>();
+    save_state(emu, *state);
+    std::unique_ptr<Emu> loaded = std::make_unique<Emu>();
+    loaded->set_quirks(emu.quirks);
+    load_state(*state, *loaded);
+    if (!same_state(emu, *loaded))
+        run.fail(name, "load_state does not reproduce save_state", frame);
+}
+
+static void check_rom(const std::string& name, const std::vector<uint8_t>& rom, QuirkProfile profile,
+                      TestRun& run) {
+    std::unique_ptr<Emu> reference = make_emu(rom, profile);
+    std::unique_ptr<Emu> emu = make_emu(rom, profile);
+    Snapshotter snapshotter;
+    Snapshot ahead;
+
+    size_t failures = run.failures;
+    for (size_t frame = 0; frame < FRAMES && run.failures == failures; ++frame) {
+        reference->run_frame();
+        emu->run_frame();
+
+        snapshotter.snapshot(*emu, ahead);
+        for (size_t i = 0; i < RUN_AHEAD; ++i) {
+            emu->run_frame();
+        }
+        snapshotter.restore(*emu, ahead);
+        if (!same_state(*reference, *emu))
+            run.fail(name, "snapshot restore differs from the machine it was taken of", frame);
+
+        if (frame % 100 == 0)
+            check_save_load(name, *emu, frame, run);
+    }
+    if (run.failures == failures)
+        run.pass(name, "save/load and snapshot round trips");
+}
+
+int main(int argc, char** argv) {
+    TestRun run;
+    check_rom("resolution flips", rom_of(RESOLUTION_FLIPS), QuirkProfile::SuperChip, run);
+    check_rom("high RAM counter", rom_of(HIGH_RAM_COUNTER), QuirkProfile::XoChip, run);
+    for (int i = 1; i < argc; ++i) {
+        std::vector<uint8_t> rom = read_rom(argv[i]);
+        if (rom.empty()) {
+            run.fail(argv[i], "cannot load ROM", 0);
+            continue;
+        }
+        check_rom(argv[i], rom, profile_for(argv[i]), run);
+    }
+    return run.failures > 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "chip8_core/state.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Shared by the differential tests in this directory. Each test is its own
+// executable that takes ROM paths, prints one line per failed check and
+// exits nonzero if there was any; CMakeLists.txt runs them on roms/bench.
+
+// Empty if the file cannot be read
+inline std::vector<uint8_t> read_rom(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>()
+    );
+}
+
+// A fresh machine with the ROM loaded. Emu is large, so it lives on the heap.
+inline std::unique_ptr<Emu> make_emu(const std::vector<uint8_t>& rom, QuirkProfile profile, uint64_t seed = 1) {
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->set_quirks(profile);
+    emu->seed(seed);
+    emu->load(rom.data(), rom.size());
+    return emu;
+}
+
+// Two machines match when save_state() writes the same bytes for both
+inline bool same_state(const Emu& a, const Emu& b) {
+    std::unique_ptr<EmuState> left = std::make_unique<EmuState>();
+    std::unique_ptr<EmuState> right = std::make_unique<EmuState>();
+    save_state(a, *left);
+    save_state(b, *right);
+    return state_size(*left) == state_size(*right)
+        && std::memcmp(left.get(), right.get(), state_size(*left)) == 0;
+}
+
+template <size_t N>
+std::vector<uint8_t> rom_of(const uint8_t (&program)[N]) {
+    return std::vector<uint8_t>(program, program + N);
+}
+
+// 00FF, DXY5, 7003, 00FE, DXY5, 7101, 1200: SUPER-CHIP, switches resolution
+// twice per loop so frames end in either one
+const uint8_t RESOLUTION_FLIPS[] = {
+    0x00, 0xFF, 0xD0, 0x15, 0x70, 0x03, 0x00, 0xFE, 0xD0, 0x15, 0x71, 0x01, 0x12, 0x00,
+};
+
+// F000 8000, 7001, F055, 1200: XO-CHIP, counts in V0 and stores it at 0x8000
+const uint8_t HIGH_RAM_COUNTER[] = {
+    0xF0, 0x00, 0x80, 0x00, 0x70, 0x01, 0xF0, 0x55, 0x12, 0x00,
+};
+
+struct TestRun {
+    size_t failures = 0;
+
+    void fail(const std::string& name, const char* what, size_t frame) {
+        std::printf("FAIL %s: %s at frame %zu\n", name.c_str(), what, frame);
+        failures++;
+    }
+
+    void pass(const std::string& name, const char* what) {
+        std::printf("ok   %s: %s\n", name.c_str(), what);
+    }
+};
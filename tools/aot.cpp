@@ -0,0 +1,365 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "chip8_core/core.h"
+
+/*
+Ahead-of-time recompiler: turns a .ch8 ROM into a C++ translation unit with
+one function per basic block, exported as an AotProgram (see chip8_core/aot.h).
+A block can be entered at any of its instructions and stops when its budget
+runs out, so frames end after exactly TICKS_PER_FRAME instructions.
+
+Usage:
+./chip8_aot game.ch8 game_aot.cpp game
+
+Then build the output with full optimization and link it against chip8_core,
+next to a driver that calls aot_step() or aot_run_frame() with the exported
+program:
+g++ -O3 -I. game_aot.cpp driver.cpp build/libchip8_core.a -pthread
+
+chip8_add_aot_check() in CMakeLists.txt does both steps for a ROM, with
+tools/aot_check.cpp as the driver, which compares the result against the
+interpreter. Leave the symbol at its default for that.
+*/
+
+// Bytes of the ROM as it sits in RAM, starting at START_ADDR
+struct Rom {
+    std::vector<uint8_t> bytes;
+
+    bool has_op(uint16_t addr) const {
+        return addr >= START_ADDR && size_t(addr - START_ADDR) + 1 < bytes.size();
+    }
+
+    uint16_t op_at(uint16_t addr) const {
+        size_t i = addr - START_ADDR;
+        return (bytes[i] << 8) | bytes[i + 1];
+    }
+};
+
+enum class Ends { No, Block };
+
+// Inline C++ for instructions with no control flow and no RAM writes, empty if none
+static std::string straight_code(const Instr& in) {
+    char buf[256];
+    int x = in.x;
+    int y = in.y;
+    switch (in.opcode) {
+        case Opcode::Nop:
+            return "    // NOP\n";
+        case Opcode::LdVxNN:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] = 0x%02X;\n", x, in.nn);
+            return buf;
+        case Opcode::AddVxNN:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] = emu.v_reg[0x%X] + 0x%02X;\n", x, x, in.nn);
+            return buf;
+        case Opcode::LdVxVy:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] = emu.v_reg[0x%X];\n", x, y);
+            return buf;
+        case Opcode::Or:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] |= emu.v_reg[0x%X];\n", x, y);
+            return buf;
+        case Opcode::And:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] &= emu.v_reg[0x%X];\n", x, y);
+            return buf;
+        case Opcode::Xor:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] ^= emu.v_reg[0x%X];\n", x, y);
+            return buf;
+        case Opcode::AddVxVy:
+            snprintf(buf, sizeof(buf),
+                     "    { uint16_t sum = emu.v_reg[0x%X] + emu.v_reg[0x%X];\n"
+                     "      emu.v_reg[0xF] = (sum > 0xFF) ? 1 : 0;\n"
+                     "      emu.v_reg[0x%X] = sum & 0xFF; }\n", x, y, x);
+            return buf;
+        case Opcode::Sub:
+            snprintf(buf, sizeof(buf),
+                     "    emu.v_reg[0xF] = (emu.v_reg[0x%X] >= emu.v_reg[0x%X]) ? 1 : 0;\n"
+                     "    emu.v_reg[0x%X] = emu.v_reg[0x%X] - emu.v_reg[0x%X];\n", x, y, x, x, y);
+            return buf;
+        case Opcode::Shr:
+            snprintf(buf, sizeof(buf),
+                     "    emu.v_reg[0xF] = emu.v_reg[0x%X] & 0x1;\n"
+                     "    emu.v_reg[0x%X] >>= 1;\n", x, x);
+            return buf;
+        case Opcode::Subn:
+            snprintf(buf, sizeof(buf),
+                     "    emu.v_reg[0xF] = (emu.v_reg[0x%X] >= emu.v_reg[0x%X]) ? 1 : 0;\n"
+                     "    emu.v_reg[0x%X] = emu.v_reg[0x%X] - emu.v_reg[0x%X];\n", y, x, x, y, x);
+            return buf;
+        case Opcode::Shl:
+            snprintf(buf, sizeof(buf),
+                     "    emu.v_reg[0xF] = (emu.v_reg[0x%X] >> 7) & 0x1;\n"
+                     "    emu.v_reg[0x%X] <<= 1;\n", x, x);
+            return buf;
+        case Opcode::LdI:
+            snprintf(buf, sizeof(buf), "    emu.i_reg = 0x%03X;\n", in.nnn);
+            return buf;
+        case Opcode::AddIVx:
+            snprintf(buf, sizeof(buf), "    emu.i_reg = emu.i_reg + emu.v_reg[0x%X];\n", x);
+            return buf;
+        case Opcode::LdFVx:
+            snprintf(buf, sizeof(buf), "    emu.i_reg = 5 * emu.v_reg[0x%X];\n", x);
+            return buf;
+        case Opcode::LdVxDt:
+            snprintf(buf, sizeof(buf), "    emu.v_reg[0x%X] = emu.dt;\n", x);
+            return buf;
+        case Opcode::LdDtVx:
+            snprintf(buf, sizeof(buf), "    emu.dt = emu.v_reg[0x%X];\n", x);
+            return buf;
+        case Opcode::LdStVx:
+            snprintf(buf, sizeof(buf), "    emu.st = emu.v_reg[0x%X];\n", x);
+            return buf;
+        case Opcode::LdVxI:
+            snprintf(buf, sizeof(buf),
+                     "    for (size_t i = 0; i <= 0x%X; ++i)\n"
+                     "        emu.v_reg[i] = emu.ram[(emu.i_reg + i) & (RAM_SIZE - 1)];\n", x);
+            return buf;
+        default:
+            return "";
+    }
+}
+
+// Whether the instruction ends a basic block, and which static successors it has
+static Ends successors(const Instr& in, uint16_t pc, std::vector<uint16_t>& next) {
+    switch (in.opcode) {
+        case Opcode::Jp:
+            next.push_back(in.nnn);
+            return Ends::Block;
+        case Opcode::Call:
+            next.push_back(in.nnn);
+            next.push_back(pc + 2);
+            return Ends::Block;
+        case Opcode::SeVxNN:
+        case Opcode::SneVxNN:
+        case Opcode::SeVxVy:
+        case Opcode::SneVxVy:
+        case Opcode::Skp:
+        case Opcode::Sknp:
+            next.push_back(pc + 2);
+            next.push_back(pc + 4);
+            return Ends::Block;
+        case Opcode::LdVxK:
+        case Opcode::LdBVx:
+        case Opcode::LdIVx:
+            // FX0A may not advance, FX33/FX55 may rewrite the code after them
+            next.push_back(pc + 2);
+            return Ends::Block;
+        case Opcode::Ret:
+        case Opcode::JpV0:
+        case Opcode::Exit:
+            return Ends::Block;
+        default:
+            return Ends::No;
+    }
+}
+
+// Emits the instruction that closes a block; pc already holds its address
+// and done counts it
+static std::string terminator_code(const Instr& in, uint16_t pc) {
+    char buf[256];
+    switch (in.opcode) {
+        case Opcode::Jp:
+            snprintf(buf, sizeof(buf), "    emu.pc = 0x%03X;\n", in.nnn);
+            return buf;
+        case Opcode::Call:
+            // A full or empty stack leaves the block before the call, for
+            // aot_step() to trap on it in the interpreter
+            snprintf(buf, sizeof(buf),
+                     "    if (emu.sp >= STACK_SIZE) { emu.pc = 0x%03X; return done - 1; }\n"
+                     "    emu.push(0x%03X);\n    emu.pc = 0x%03X;\n", pc, pc, in.nnn);
+            return buf;
+        case Opcode::Ret:
+            snprintf(buf, sizeof(buf),
+                     "    if (emu.sp == 0) { emu.pc = 0x%03X; return done - 1; }\n"
+                     "    emu.pc = emu.pop();\n    emu.pc += 2;\n", pc);
+            return buf;
+        case Opcode::JpV0:
+            snprintf(buf, sizeof(buf), "    emu.pc = emu.v_reg[0] + 0x%03X;\n", in.nnn);
+            return buf;
+        case Opcode::SeVxNN:
+        case Opcode::SneVxNN:
+            snprintf(buf, sizeof(buf), "    emu.pc = (emu.v_reg[0x%X] %s 0x%02X) ? 0x%03X : 0x%03X;\n",
+                     in.x, in.opcode == Opcode::SeVxNN ? "==" : "!=", in.nn, pc + 4, pc + 2);
+            return buf;
+        case Opcode::SeVxVy:
+        case Opcode::SneVxVy:
+            snprintf(buf, sizeof(buf), "    emu.pc = (emu.v_reg[0x%X] %s emu.v_reg[0x%X]) ? 0x%03X : 0x%03X;\n",
+                     in.x, in.opcode == Opcode::SeVxVy ? "==" : "!=", in.y, pc + 4, pc + 2);
+            return buf;
+        default:
+            snprintf(buf, sizeof(buf), "    emu.pc = 0x%03X;\n    emu.execute(0x%04X);\n", pc, in.op);
+            return buf;
+    }
+}
+
+struct Block {
+    uint16_t start;
+    uint16_t end;  // one past the last byte
+    std::string body;
+    std::vector<uint16_t> pcs;  // of its instructions, each also an entry point
+};
+
+// Each instruction is a case of the block's switch on emu.pc, so the block
+// can be entered where the last one ran out of budget, and checks the budget
+// before it runs
+static std::string entry_code(uint16_t pc, bool first) {
+    char buf[160];
+    snprintf(buf, sizeof(buf),
+             "%s    case 0x%03X:\n"
+             "    if (done == budget) { emu.pc = 0x%03X; return done; }\n"
+             "    done++;\n", first ? "" : "    [[fallthrough]];\n", pc, pc);
+    return buf;
+}
+
+static Block translate_block(const Rom& rom, uint16_t start, std::vector<uint16_t>& next) {
+    Block block{start, start, "", {}};
+    uint16_t pc = start;
+    while (rom.has_op(pc)) {
+        Instr in = decode_instr(rom.op_at(pc));
+        // Unknown and XO-CHIP opcodes trap under the default profile the
+        // generated code assumes. The block stops short of them so that
+        // aot_step() runs them through tick() and can report the Status.
+        if (in.opcode >= Opcode::LdILong) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "    emu.pc = 0x%03X;\n", pc);
+            block.body += buf;
+            block.end = pc;
+            return block;
+        }
+        block.body += entry_code(pc, block.pcs.empty());
+        block.pcs.push_back(pc);
+
+        if (successors(in, pc, next) == Ends::Block) {
+            block.body += terminator_code(in, pc);
+            pc += 2;
+            block.end = pc;
+            return block;
+        }
+
+        std::string code = straight_code(in);
+        if (code.empty()) {
+            // DRW, CLS, RND and friends stay in the interpreter
+            char buf[64];
+            snprintf(buf, sizeof(buf), "    emu.pc = 0x%03X;\n    emu.execute(0x%04X);\n", pc, in.op);
+            code = buf;
+        }
+        block.body += code;
+        pc += 2;
+    }
+    // Ran off the end of the ROM, hand back to the interpreter there
+    char buf[64];
+    snprintf(buf, sizeof(buf), "    emu.pc = 0x%03X;\n", pc);
+    block.body += buf;
+    block.end = pc;
+    return block;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <rom.ch8> <out.cpp> [symbol]\n";
+        return 1;
+    }
+    const char* rom_path = argv[1];
+    const char* out_path = argv[2];
+    std::string symbol = argc > 3 ? argv[3] : "aot_program";
+
+    std::ifstream rom_file(rom_path, std::ios::binary);
+    if (!rom_file.is_open()) {
+        std::cerr << "Did not find file: " << rom_path << "\n";
+        return 1;
+    }
+
+    Rom rom;
+    rom.bytes.assign(
+        (std::istreambuf_iterator<char>(rom_file)),
+        std::istreambuf_iterator<char>()
+    );
+
+    // Recursive traversal from the entry point
+    std::map<uint16_t, Block> blocks;
+    std::vector<uint16_t> worklist = { START_ADDR };
+    while (!worklist.empty()) {
+        uint16_t start = worklist.back();
+        worklist.pop_back();
+        if (blocks.count(start) || !rom.has_op(start))
+            continue;
+        std::vector<uint16_t> next;
+        blocks[start] = translate_block(rom, start, next);
+        worklist.insert(worklist.end(), next.begin(), next.end());
+    }
+
+    // A block that would start on a trapping opcode is left to the interpreter
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        it = it->second.pcs.empty() ? blocks.erase(it) : std::next(it);
+    }
+
+    std::ofstream out(out_path);
+    if (!out.is_open()) {
+        std::cerr << "Could not write: " << out_path << "\n";
+        return 1;
+    }
+
+    out << "// Generated by chip8_aot from " << rom_path << ". Do not edit.\n\n";
+    out << "#include \"chip8_core/aot.h\"\n\n#include <cstring>\n\n";
+    out << "namespace {\n\n";
+
+    out << "const uint8_t ROM[] = {";
+    for (size_t i = 0; i < rom.bytes.size(); ++i) {
+        if (i % 16 == 0)
+            out << "\n   ";
+        char buf[8];
+        snprintf(buf, sizeof(buf), " 0x%02X,", rom.bytes[i]);
+        out << buf;
+    }
+    out << "\n};\n\n";
+
+    out << "// The block is only valid while its bytes are untouched in RAM\n";
+    out << "bool unchanged(const Emu& emu, uint16_t start, uint16_t end) {\n";
+    out << "    return std::memcmp(emu.ram + start, ROM + (start - START_ADDR), end - start) == 0;\n";
+    out << "}\n\n";
+
+    for (const auto& entry : blocks) {
+        const Block& block = entry.second;
+        char buf[64];
+        snprintf(buf, sizeof(buf), "size_t block_%03X(Emu& emu, size_t budget) {\n", block.start);
+        out << buf << "    size_t done = 0;\n    switch (emu.pc) {\n" << block.body;
+        out << "    }\n    return done;\n}\n\n";
+    }
+
+    // Every instruction goes to the block starting there, else to the first
+    // block it lies in
+    std::map<uint16_t, const Block*> entries;
+    for (const auto& entry : blocks) {
+        entries[entry.first] = &entry.second;
+    }
+    for (const auto& entry : blocks) {
+        for (uint16_t pc : entry.second.pcs) {
+            entries.emplace(pc, &entry.second);
+        }
+    }
+
+    out << "size_t step(Emu& emu, size_t budget) {\n";
+    out << "    switch (emu.pc) {\n";
+    for (const auto& entry : entries) {
+        const Block& block = *entry.second;
+        char buf[192];
+        snprintf(buf, sizeof(buf),
+                 "        case 0x%03X: return unchanged(emu, 0x%03X, 0x%03X) ? block_%03X(emu, budget) : 0;\n",
+                 entry.first, entry.first, block.end, block.start);
+        out << buf;
+    }
+    out << "        default: return 0;\n";
+    out << "    }\n}\n\n";
+    out << "}  // namespace\n\n";
+
+    out << "extern const AotProgram " << symbol << " = {\n";
+    out << "    \"" << symbol << "\", ROM, sizeof(ROM), step\n};\n";
+
+    std::cout << "Translated " << blocks.size() << " blocks to " << out_path << "\n";
+    return 0;
+}
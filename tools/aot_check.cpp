@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "chip8_core/aot.h"
+
+/*
+Replays a ROM translated by chip8_aot against the interpreter and stops at
+the first difference. Build it together with the generated file, exported
+under chip8_aot's default symbol; chip8_add_aot_check() in CMakeLists.txt
+does both steps.
+
+Usage:
+./chip8_aot_check_<rom> [--frames N] [--seed N]
+
+Frames are compared one at a time: the translation runs them through
+aot_run_frame(), the reference through Emu::run_frame().
+*/
+
+extern const AotProgram aot_program;
+
+// Name of the first field that differs, or nullptr
+static const char* compare(const Emu& expected, const Emu& actual) {
+    if (expected.pc != actual.pc) return "pc";
+    if (expected.i_reg != actual.i_reg) return "I";
+    if (expected.sp != actual.sp) return "sp";
+    if (expected.dt != actual.dt) return "DT";
+    if (expected.st != actual.st) return "ST";
+    if (std::memcmp(expected.v_reg, actual.v_reg, sizeof(expected.v_reg)) != 0) return "V registers";
+    if (std::memcmp(expected.stack, actual.stack, sizeof(expected.stack)) != 0) return "stack";
+    if (std::memcmp(expected.ram, actual.ram, sizeof(expected.ram)) != 0) return "RAM";
+    if (expected.hires != actual.hires) return "resolution";
+    if (std::memcmp(expected.get_display(), actual.get_display(),
+                    expected.display_height() * expected.display_width() / 8) != 0)
+        return "display";
+    return nullptr;
+}
+
+int main(int argc, char** argv) {
+    size_t frames = 600;
+    uint32_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--frames N] [--seed N]\n";
+            return 1;
+        }
+    }
+
+    // Emu is large; keep both off the stack
+    std::unique_ptr<Emu> compiled = std::make_unique<Emu>();
+    std::unique_ptr<Emu> reference = std::make_unique<Emu>();
+    for (Emu* emu : {compiled.get(), reference.get()}) {
+        emu->seed(seed);
+        emu->load(aot_program.rom, aot_program.rom_size);
+    }
+
+    for (size_t frame = 0; frame < frames; ++frame) {
+        RunResult result = aot_run_frame(aot_program, *compiled);
+        RunResult expected = reference->run_frame();
+        if (result.status != expected.status) {
+            std::printf("%s: status differs in frame %zu\n", aot_program.name, frame);
+            return 1;
+        }
+        if (const char* field = compare(*reference, *compiled)) {
+            std::printf("%s: %s differs after frame %zu, pc 0x%03X\n",
+                        aot_program.name, field, frame, reference->pc);
+            return 1;
+        }
+        if (result.status == Status::Halted) {
+            frames = frame + 1;
+            break;
+        }
+    }
+
+    std::printf("%s: %zu frames match\n", aot_program.name, frames);
+    return 0;
+}
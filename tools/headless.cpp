@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8_core/audio.h"
+#include "chip8_core/core.h"
+#include "chip8_core/jit.h"
+#include "chip8_core/trace.h"
+
+/*
+Headless batch runner: no window, no file dialog, no SDL.
+
+Usage:
+./chip8_headless [options] <rom.ch8 | rom.sc8 | rom.xo8 | directory>...
+
+Options:
+  --frames N       frames to run per ROM (default 600)
+  --seed N         seed for CXNN so runs are reproducible (default 1)
+  --input FILE     input script, one "<frame> <key> down|up" per line, key in hex
+  --every          print the framebuffer hash after every frame, not just the last
+  --threads N      worker threads (default: one per core)
+  --quirks NAME    quirk profile for every ROM: default, vip, schip or xochip
+                   (default: by extension, schip for .sc8, xochip for .xo8,
+                   default for anything else)
+  --on-trap MODE   unknown opcodes: halt (stop the ROM with an error), skip
+                   (step over and count them) or nop (step over silently);
+                   default halt
+  --wav FILE       record the sound timer's output as 44.1 kHz mono PCM; needs
+                   exactly one ROM and runs every frame, even wait loops
+  --jit            run frames through the JIT (see chip8_core/jit.h); only
+                   the default quirk profile is compiled, the rest is ticked
+  --jit-verify     like --jit, and replay every block through the interpreter,
+                   failing the ROM on the first difference
+  --trace FILE     record every executed instruction for chip8_trace_dump;
+                   needs a core built with -DCHIP8_TRACE=ON and exactly one
+                   ROM, and turns off skipping of wait loops
+
+Directories are expanded to the *.ch8, *.sc8 and *.xo8 files inside them. ROMs are spread over
+the worker threads and results are printed in command line order. Frames the
+ROM spends in a wait loop (see Emu::fast_forward) are skipped, not executed.
+*/
+
+struct InputEvent {
+    size_t frame;
+    size_t key;
+    bool pressed;
+};
+
+struct Job {
+    std::string path;
+    std::vector<uint64_t> hashes;
+    double seconds;
+    uint64_t instructions;  // executed, not counting skipped frames or wait spins
+    uint64_t skipped;       // frames fast-forwarded through wait loops
+    uint64_t traps;         // unknown opcodes stepped over with --on-trap skip
+    std::string error;
+};
+
+struct Options {
+    size_t frames = 600;
+    uint32_t seed = 1;
+    bool every = false;
+    size_t threads = std::thread::hardware_concurrency();
+    TrapPolicy on_trap = TrapPolicy::Halt;
+    QuirkProfile quirks = QuirkProfile::Default;
+    bool quirks_set = false;  // --quirks given, otherwise see profile_for()
+    std::vector<InputEvent> input;
+    const char* wav = nullptr;
+    bool jit = false;
+    bool jit_verify = false;
+    const char* trace = nullptr;
+};
+
+// FNV-1a over the packed display rows of the current resolution
+static uint64_t hash_display(const Emu& emu) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const uint64_t* words = emu.get_display();
+    size_t count = emu.display_height() * emu.display_width() / 64;
+    for (size_t i = 0; i < count; ++i) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (words[i] >> shift) & 0xFF;
+            hash *= 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+static bool read_input_script(const char* path, std::vector<InputEvent>& out) {
+    std::ifstream file(path);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        InputEvent evt;
+        std::string action;
+        fields >> std::dec >> evt.frame >> std::hex >> evt.key >> action;
+        if (fields.fail() || evt.key >= NUM_KEYS || (action != "down" && action != "up")) {
+            std::cerr << "Bad input line: " << line << "\n";
+            return false;
+        }
+        evt.pressed = action == "down";
+        out.push_back(evt);
+    }
+    std::stable_sort(out.begin(), out.end(), [](const InputEvent& a, const InputEvent& b) {
+        return a.frame < b.frame;
+    });
+    return true;
+}
+
+static void run_job(Job& job, const Options& options) {
+    std::ifstream rom(job.path, std::ios::binary);
+    if (!rom.is_open()) {
+        job.error = "Did not find file";
+        return;
+    }
+    std::vector<uint8_t> buffer(
+        (std::istreambuf_iterator<char>(rom)),
+        std::istreambuf_iterator<char>()
+    );
+
+    // Emu is large; keep it off the worker's stack
+    std::unique_ptr<Emu> emu = std::make_unique<Emu>();
+    emu->seed(options.seed);
+    emu->set_trap_policy(options.on_trap);
+    emu->set_quirks(options.quirks_set ? options.quirks : profile_for(job.path.c_str()));
+    // XO-CHIP ROMs may fill the whole 64 KB address space
+    if (buffer.size() > emu->memory_size() - START_ADDR) {
+        job.error = "ROM too large";
+        return;
+    }
+    emu->load(buffer.data(), buffer.size());
+
+    size_t next_input = 0;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::unique_ptr<WavWriter> wav;
+        if (options.wav)
+            wav = std::make_unique<WavWriter>(options.wav);
+        AudioSynth synth;
+        int16_t samples[AUDIO_SAMPLES_PER_FRAME];
+        std::unique_ptr<Tracer> tracer;
+        if (options.trace) {
+            tracer = std::make_unique<Tracer>(options.trace);
+            emu->tracer = tracer.get();
+        }
+        std::unique_ptr<Jit> jit;
+        if (options.jit) {
+            jit = std::make_unique<Jit>();
+            jit->set_verify(options.jit_verify);
+        }
+
+        size_t frame = 0;
+        while (frame < options.frames) {
+            while (next_input < options.input.size() && options.input[next_input].frame == frame) {
+                emu->keypress(options.input[next_input].key, options.input[next_input].pressed);
+                next_input++;
+            }
+
+            // A wait loop can be jumped over up to the next scripted input
+            size_t until = options.frames;
+            if (next_input < options.input.size())
+                until = std::min(until, options.input[next_input].frame);
+            // Recording renders each frame from the sound timer it starts with
+            if (wav) {
+                until = frame + 1;
+                synth.render_frame(*emu, samples);
+                wav->write(samples, AUDIO_SAMPLES_PER_FRAME);
+            }
+            // Skipped frames would be missing from the trace
+            size_t step = tracer ? 0 : emu->fast_forward(until - frame);
+            if (step > 0) {
+                job.skipped += step;
+            } else {
+                RunResult result = jit ? jit->run_frame(*emu) : emu->run_frame();
+                job.instructions += result.cycles;
+                job.traps += result.traps;
+                if (result.status == Status::Halted) {
+                    char buffer[64];
+                    std::snprintf(buffer, sizeof(buffer), "Unknown opcode 0x%04X at 0x%03X in frame %zu",
+                                  emu->fetch(), emu->pc, frame);
+                    job.error = buffer;
+                    break;
+                }
+                step = 1;
+            }
+
+            // The display cannot change while skipping, so every skipped frame has this hash
+            for (size_t f = frame; f < frame + step; ++f) {
+                if (options.every || f + 1 == options.frames)
+                    job.hashes.push_back(hash_display(*emu));
+            }
+            frame += step;
+        }
+    } catch (const std::exception& e) {
+        job.error = e.what();
+    }
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void collect_roms(const char* arg, std::vector<Job>& jobs) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_directory(arg, ec)) {
+        jobs.push_back(Job{arg, {}, 0.0, 0, 0, 0, ""});
+        return;
+    }
+    std::vector<std::string> found;
+    for (const auto& entry : fs::directory_iterator(arg, ec)) {
+        std::string ext = entry.path().extension().string();
+        if (entry.is_regular_file() && (ext == ".ch8" || ext == ".sc8" || ext == ".xo8"))
+            found.push_back(entry.path().string());
+    }
+    std::sort(found.begin(), found.end());
+    for (const std::string& path : found) {
+        jobs.push_back(Job{path, {}, 0.0, 0, 0, 0, ""});
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<Job> jobs;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--seed") == 0 && has_value) {
+            options.seed = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            options.threads = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--input") == 0 && has_value) {
+            if (!read_input_script(argv[++i], options.input)) {
+                std::cerr << "Could not read input script: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--quirks") == 0 && has_value) {
+            options.quirks_set = true;
+            if (!parse_quirk_profile(argv[++i], options.quirks)) {
+                std::cerr << "Unknown quirk profile: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--on-trap") == 0 && has_value) {
+            const char* mode = argv[++i];
+            if (std::strcmp(mode, "halt") == 0) {
+                options.on_trap = TrapPolicy::Halt;
+            } else if (std::strcmp(mode, "skip") == 0) {
+                options.on_trap = TrapPolicy::Skip;
+            } else if (std::strcmp(mode, "nop") == 0) {
+                options.on_trap = TrapPolicy::Nop;
+            } else {
+                std::cerr << "Unknown trap mode: " << mode << "\n";
+                return 1;
+            }
+        } else if (std::strcmp(arg, "--wav") == 0 && has_value) {
+            options.wav = argv[++i];
+        } else if (std::strcmp(arg, "--trace") == 0 && has_value) {
+            options.trace = argv[++i];
+        } else if (std::strcmp(arg, "--jit") == 0) {
+            options.jit = true;
+        } else if (std::strcmp(arg, "--jit-verify") == 0) {
+            options.jit = true;
+            options.jit_verify = true;
+        } else if (std::strcmp(arg, "--every") == 0) {
+            options.every = true;
+        } else if (arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        } else {
+            collect_roms(arg, jobs);
+        }
+    }
+
+    if (jobs.empty()) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--frames N] [--seed N] [--input FILE] [--every] [--threads N]"
+                  << " [--quirks NAME] [--on-trap halt|skip|nop] [--wav FILE] [--jit] [--jit-verify] [--trace FILE] <rom|dir>...\n";
+        return 1;
+    }
+    if (options.wav && jobs.size() != 1) {
+        std::cerr << "--wav records a single ROM\n";
+        return 1;
+    }
+    if (options.trace && jobs.size() != 1) {
+        std::cerr << "--trace records a single ROM\n";
+        return 1;
+    }
+    if (options.trace && !TRACE_ENABLED) {
+        std::cerr << "--trace needs chip8_core built with -DCHIP8_TRACE=ON\n";
+        return 1;
+    }
+
+    // Not Runner: its jobs are opaque "K frames" runs, while every frame here
+    // may need scripted input, a hash, audio or the JIT, and a halt has to be
+    // reported rather than end the job quietly. One ROM per worker at a time
+    // is all the scheduling this needs.
+    size_t num_threads = std::min(std::max<size_t>(options.threads, 1), jobs.size());
+    std::atomic<size_t> next_job{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&] {
+            for (size_t j = next_job++; j < jobs.size(); j = next_job++) {
+                run_job(jobs[j], options);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    int status = 0;
+    for (const Job& job : jobs) {
+        if (!job.error.empty()) {
+            std::printf("%s error %s\n", job.path.c_str(), job.error.c_str());
+            status = 1;
+            continue;
+        }
+        size_t first_frame = options.every ? 0 : options.frames - 1;
+        for (size_t i = 0; i < job.hashes.size(); ++i) {
+            std::printf("%s frame %zu hash %016llx\n", job.path.c_str(), first_frame + i,
+                        static_cast<unsigned long long>(job.hashes[i]));
+        }
+        double ips = job.seconds > 0 ? job.instructions / job.seconds : 0.0;
+        std::printf("%s instructions %llu ips %.0f skipped %llu frames\n", job.path.c_str(),
+                    static_cast<unsigned long long>(job.instructions), ips,
+                    static_cast<unsigned long long>(job.skipped));
+        if (job.traps > 0)
+            std::printf("%s traps %llu\n", job.path.c_str(), static_cast<unsigned long long>(job.traps));
+    }
+    return status;
+}
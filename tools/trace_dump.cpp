@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <iostream>
+
+#include "chip8_core/core.h"
+#include "chip8_core/trace.h"
+
+/*
+Prints a binary trace written by Tracer (build the core with CHIP8_TRACE=1).
+
+Usage:
+./chip8_trace_dump trace.bin
+*/
+
+static void disassemble(uint16_t op, char* out, size_t size) {
+    Instr in = decode_instr(op);
+    switch (in.opcode) {
+        case Opcode::Nop:     snprintf(out, size, "NOP"); break;
+        case Opcode::Cls:     snprintf(out, size, "CLS"); break;
+        case Opcode::Ret:     snprintf(out, size, "RET"); break;
+        case Opcode::Jp:      snprintf(out, size, "JP 0x%03X", in.nnn); break;
+        case Opcode::Call:    snprintf(out, size, "CALL 0x%03X", in.nnn); break;
+        case Opcode::SeVxNN:  snprintf(out, size, "SE V%X, 0x%02X", in.x, in.nn); break;
+        case Opcode::SneVxNN: snprintf(out, size, "SNE V%X, 0x%02X", in.x, in.nn); break;
+        case Opcode::SeVxVy:  snprintf(out, size, "SE V%X, V%X", in.x, in.y); break;
+        case Opcode::LdVxNN:  snprintf(out, size, "LD V%X, 0x%02X", in.x, in.nn); break;
+        case Opcode::AddVxNN: snprintf(out, size, "ADD V%X, 0x%02X", in.x, in.nn); break;
+        case Opcode::LdVxVy:  snprintf(out, size, "LD V%X, V%X", in.x, in.y); break;
+        case Opcode::Or:      snprintf(out, size, "OR V%X, V%X", in.x, in.y); break;
+        case Opcode::And:     snprintf(out, size, "AND V%X, V%X", in.x, in.y); break;
+        case Opcode::Xor:     snprintf(out, size, "XOR V%X, V%X", in.x, in.y); break;
+        case Opcode::AddVxVy: snprintf(out, size, "ADD V%X, V%X", in.x, in.y); break;
+        case Opcode::Sub:     snprintf(out, size, "SUB V%X, V%X", in.x, in.y); break;
+        case Opcode::Shr:     snprintf(out, size, "SHR V%X", in.x); break;
+        case Opcode::Subn:    snprintf(out, size, "SUBN V%X, V%X", in.x, in.y); break;
+        case Opcode::Shl:     snprintf(out, size, "SHL V%X", in.x); break;
+        case Opcode::SneVxVy: snprintf(out, size, "SNE V%X, V%X", in.x, in.y); break;
+        case Opcode::LdI:     snprintf(out, size, "LD I, 0x%03X", in.nnn); break;
+        case Opcode::JpV0:    snprintf(out, size, "JP V0, 0x%03X", in.nnn); break;
+        case Opcode::Rnd:     snprintf(out, size, "RND V%X, 0x%02X", in.x, in.nn); break;
+        case Opcode::Drw:     snprintf(out, size, "DRW V%X, V%X, %u", in.x, in.y, in.n); break;
+        case Opcode::Skp:     snprintf(out, size, "SKP V%X", in.x); break;
+        case Opcode::Sknp:    snprintf(out, size, "SKNP V%X", in.x); break;
+        case Opcode::LdVxDt:  snprintf(out, size, "LD V%X, DT", in.x); break;
+        case Opcode::LdVxK:   snprintf(out, size, "LD V%X, K", in.x); break;
+        case Opcode::LdDtVx:  snprintf(out, size, "LD DT, V%X", in.x); break;
+        case Opcode::LdStVx:  snprintf(out, size, "LD ST, V%X", in.x); break;
+        case Opcode::AddIVx:  snprintf(out, size, "ADD I, V%X", in.x); break;
+        case Opcode::LdFVx:   snprintf(out, size, "LD F, V%X", in.x); break;
+        case Opcode::LdBVx:   snprintf(out, size, "LD B, V%X", in.x); break;
+        case Opcode::LdIVx:   snprintf(out, size, "LD [I], V%X", in.x); break;
+        case Opcode::LdVxI:   snprintf(out, size, "LD V%X, [I]", in.x); break;
+        case Opcode::Scd:     snprintf(out, size, "SCD %u", in.n); break;
+        case Opcode::Scr:     snprintf(out, size, "SCR"); break;
+        case Opcode::Scl:     snprintf(out, size, "SCL"); break;
+        case Opcode::Exit:    snprintf(out, size, "EXIT"); break;
+        case Opcode::Low:     snprintf(out, size, "LOW"); break;
+        case Opcode::High:    snprintf(out, size, "HIGH"); break;
+        case Opcode::LdHfVx:  snprintf(out, size, "LD HF, V%X", in.x); break;
+        case Opcode::LdRVx:   snprintf(out, size, "LD R, V%X", in.x); break;
+        case Opcode::LdVxR:   snprintf(out, size, "LD V%X, R", in.x); break;
+        // The NNNN word is not in the record; the new I shows up after it
+        case Opcode::LdILong: snprintf(out, size, "LD I, LONG"); break;
+        case Opcode::SaveRange: snprintf(out, size, "SAVE V%X-V%X", in.x, in.y); break;
+        case Opcode::LoadRange: snprintf(out, size, "LOAD V%X-V%X", in.x, in.y); break;
+        case Opcode::Plane:   snprintf(out, size, "PLANE %u", in.x); break;
+        case Opcode::Audio:   snprintf(out, size, "AUDIO"); break;
+        case Opcode::Pitch:   snprintf(out, size, "PITCH V%X", in.x); break;
+        case Opcode::Scu:     snprintf(out, size, "SCU %u", in.n); break;
+        default:              snprintf(out, size, "??? 0x%04X", op); break;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <trace.bin>\n";
+        return 1;
+    }
+
+    std::FILE* file = std::fopen(argv[1], "rb");
+    if (!file) {
+        std::cerr << "Did not find file: " << argv[1] << "\n";
+        return 1;
+    }
+
+    TraceHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC) {
+        std::cerr << "Not a CHIP-8 trace: " << argv[1] << "\n";
+        std::fclose(file);
+        return 1;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        std::cerr << "Unsupported trace version " << header.version << "\n";
+        std::fclose(file);
+        return 1;
+    }
+
+    TraceRecord rec;
+    char text[32];
+    while (std::fread(&rec, sizeof(rec), 1, file) == 1) {
+        disassemble(rec.op, text, sizeof(text));
+        std::printf("%10llu  0x%03X  %04X  %-16s I=0x%03X",
+                    static_cast<unsigned long long>(rec.cycle), rec.pc, rec.op, text, rec.i_reg);
+        if (rec.reg != TRACE_NO_REG)
+            std::printf("  V%X=0x%02X", rec.reg, rec.value);
+        std::printf("\n");
+    }
+
+    std::fclose(file);
+    return 0;
+}